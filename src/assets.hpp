@@ -647,13 +647,6 @@ struct Assets {
 	template <typename T>
 	AssetPtr<T> query (std::string_view str);
 
-	template<> AssetPtr<PropAsset> query<PropAsset> (std::string_view str) {
-		return props[str];
-	}
-	template<> AssetPtr<TrafficLightPropsAsset> query<TrafficLightPropsAsset> (std::string_view str) {
-		return traffic_light_props[str];
-	}
-
 	void reload_all () {
 		for (auto& a : props              ) a->reload();
 		for (auto& a : traffic_light_props) a->reload();
@@ -679,10 +672,18 @@ struct Assets {
 
 };
 
+// explicit specializations can't be in class scope (only msvc allows it)
+template<> inline AssetPtr<PropAsset> Assets::query<PropAsset> (std::string_view str) {
+	return props[str];
+}
+template<> inline AssetPtr<TrafficLightPropsAsset> Assets::query<TrafficLightPropsAsset> (std::string_view str) {
+	return traffic_light_props[str];
+}
+
 template <typename T> void to_json (json& j, AssetPtr<T> const& ptr) {
 	j = ptr->name;
 }
-template <typename T> void from_json<> (json const& j, AssetPtr<T>& ptr) {
+template <typename T> void from_json (json const& j, AssetPtr<T>& ptr) {
 	ptr = g_assets->query<T>(j.get<std::string>());
 }
 
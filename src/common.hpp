@@ -93,26 +93,34 @@ using namespace kiss;
 
 #include "tracy/Tracy.hpp"
 #include "dear_imgui.hpp"
+#if HEADLESS
+// headless runner (CMakeLists.txt) builds without window and renderer, the sim only needs Input from the engine
+#include "engine/input.hpp"
+#else
 #include "engine.hpp"
+#endif
+
+// stderr in run_headless, so its json report on stdout stays parseable
+inline FILE* log_file = stdout;
 
 template <typename... Ts>
 inline void log (const char* format, Ts... args) {
-	fprintf(stdout, format, args...);
-	fflush(stdout);
+	fprintf(log_file, format, args...);
+	fflush(log_file);
 }
 template <typename... Ts>
 inline void log_warn (const char* format, Ts... args) {
-	fprintf(stdout, "\x1B[33m");
-	fprintf(stdout, format, args...);
-	fprintf(stdout, "\033[0m");
-	fflush(stdout);
+	fprintf(log_file, "\x1B[33m");
+	fprintf(log_file, format, args...);
+	fprintf(log_file, "\033[0m");
+	fflush(log_file);
 }
 template <typename... Ts>
 inline void log_error (const char* format, Ts... args) {
-	fprintf(stdout, "\x1B[31m");
-	fprintf(stdout, format, args...);
-	fprintf(stdout, "\033[0m");
-	fflush(stdout);
+	fprintf(log_file, "\x1B[31m");
+	fprintf(log_file, format, args...);
+	fprintf(log_file, "\033[0m");
+	fflush(log_file);
 }
 
 template <typename... Ts>
@@ -0,0 +1,348 @@
+#include "common.hpp"
+#include "contraction_hierarchy.hpp"
+#include "network_sim.hpp"
+
+namespace network {
+
+//// ContractionHierarchy
+std::unique_ptr<ContractionHierarchy> ContractionHierarchy::build (TurnGraph const& graph) {
+	ZoneScoped;
+	auto start_time = std::chrono::steady_clock::now();
+
+	int num_vertices = graph.num_vertices();
+
+	// Mutable graph during contraction, edges to contracted vertices are simply ignored
+	struct DynEdge {
+		int   other;
+		float cost;
+		int   mid;
+	};
+	std::vector<std::vector<DynEdge>> out(num_vertices), in(num_vertices);
+
+	// add edge or lower cost of existing one, keeping at most one edge per vertex pair
+	auto add_edge = [&] (int from, int to, float cost, int mid) {
+		for (auto& e : out[from]) {
+			if (e.other == to) {
+				if (cost < e.cost) {
+					e.cost = cost;
+					e.mid = mid;
+					for (auto& e2 : in[to]) {
+						if (e2.other == from) {
+							e2.cost = cost;
+							e2.mid = mid;
+						}
+					}
+				}
+				return false;
+			}
+		}
+		out[from].push_back({ to, cost, mid });
+		in[to].push_back({ from, cost, mid });
+		return true;
+	};
+
+	for (int v=0; v<num_vertices; ++v) {
+		for (int i=graph.edges_begin[v]; i<graph.edges_begin[v+1]; ++i) {
+			auto& e = graph.edges[i];
+			if (e.target != v) // self loops are never part of shortest paths
+				add_edge(v, e.target, e.cost, -1);
+		}
+	}
+
+	std::vector<bool> contracted(num_vertices, false);
+	std::vector<int> deleted_neighbours(num_vertices, 0);
+
+	typedef std::pair<float, int> Queued;
+	typedef std::priority_queue<Queued, std::vector<Queued>, std::greater<Queued>> MinQueue;
+
+	// witness search: bounded dijkstra from source, not passing through skip
+	// results in dist, which is reset lazily via touched list
+	// stops early once all vertices flagged in is_target are settled
+	std::vector<float> dist(num_vertices, INF);
+	std::vector<int> touched;
+	std::vector<bool> is_target(num_vertices, false);
+
+	auto witness_search = [&] (int source, int skip, float max_cost, int num_targets, int max_settled) {
+		for (int t : touched) dist[t] = INF;
+		touched.clear();
+
+		MinQueue queue;
+		dist[source] = 0;
+		touched.push_back(source);
+		queue.push({ 0.0f, source });
+
+		int settled = 0;
+		while (!queue.empty()) {
+			auto [cost, u] = queue.top();
+			queue.pop();
+			if (cost > dist[u]) continue; // stale
+			if (cost > max_cost || ++settled > max_settled) break;
+
+			if (is_target[u] && --num_targets == 0) break;
+
+			for (auto& e : out[u]) {
+				if (contracted[e.other] || e.other == skip) continue;
+
+				float new_cost = cost + e.cost;
+				if (new_cost < dist[e.other]) {
+					if (dist[e.other] == INF) touched.push_back(e.other);
+					dist[e.other] = new_cost;
+					queue.push({ new_cost, e.other });
+				}
+			}
+		}
+	};
+
+	// contract v by adding shortcuts for all in -> v -> out paths that have no witness
+	// dry_run only counts shortcuts with a cheaper witness search for priority estimation
+	auto contract = [&] (int v, bool dry_run) {
+		int shortcuts = 0;
+
+		for (auto& e_in : in[v]) {
+			int u = e_in.other;
+			if (contracted[u]) continue;
+
+			float max_cost = 0;
+			int num_targets = 0;
+			for (auto& e_out : out[v]) {
+				if (!contracted[e_out.other] && e_out.other != u && !is_target[e_out.other]) {
+					max_cost = max(max_cost, e_in.cost + e_out.cost);
+					is_target[e_out.other] = true;
+					num_targets++;
+				}
+			}
+			if (num_targets == 0) continue;
+
+			witness_search(u, v, max_cost, num_targets, dry_run ? 50 : 500);
+
+			for (auto& e_out : out[v])
+				is_target[e_out.other] = false;
+
+			for (auto& e_out : out[v]) {
+				int w = e_out.other;
+				if (contracted[w] || w == u) continue;
+
+				float cost = e_in.cost + e_out.cost;
+				if (dist[w] <= cost) continue; // witness found, no shortcut needed
+
+				shortcuts++;
+				if (!dry_run) add_edge(u, w, cost, v);
+			}
+		}
+		return shortcuts;
+	};
+
+	// edge difference heuristic, plus deleted neighbours to contract uniformly across the graph
+	auto priority = [&] (int v) {
+		int degree = 0;
+		for (auto& e : in[v])  if (!contracted[e.other]) degree++;
+		for (auto& e : out[v]) if (!contracted[e.other]) degree++;
+
+		return (float)(contract(v, true) - degree + deleted_neighbours[v]);
+	};
+
+	MinQueue queue;
+	for (int v=0; v<num_vertices; ++v) {
+		queue.push({ priority(v), v });
+	}
+
+	std::vector<std::vector<Edge>> up(num_vertices), down(num_vertices);
+	int shortcuts = 0;
+
+	while (!queue.empty()) {
+		int v = queue.top().second;
+		queue.pop();
+		if (contracted[v]) continue;
+
+		// lazy update, priority might have risen since neighbours were contracted
+		float prio = priority(v);
+		if (!queue.empty() && prio > queue.top().first) {
+			queue.push({ prio, v });
+			continue;
+		}
+
+		// all remaining neighbours get contracted later, ie. are higher ranked
+		for (auto& e : out[v]) if (!contracted[e.other]) up  [v].push_back({ e.other, e.cost, e.mid });
+		for (auto& e : in[v])  if (!contracted[e.other]) down[v].push_back({ e.other, e.cost, e.mid });
+
+		shortcuts += contract(v, false);
+		contracted[v] = true;
+
+		for (auto& e : out[v]) deleted_neighbours[e.other]++;
+		for (auto& e : in[v])  deleted_neighbours[e.other]++;
+	}
+
+	// flatten into CSR
+	auto ch = std::make_unique<ContractionHierarchy>();
+	auto flatten = [&] (std::vector<std::vector<Edge>>& lists, std::vector<int>& begin, std::vector<Edge>& edges) {
+		begin.resize(num_vertices + 1);
+		edges.clear();
+		for (int v=0; v<num_vertices; ++v) {
+			begin[v] = (int)edges.size();
+			edges.insert(edges.end(), lists[v].begin(), lists[v].end());
+		}
+		begin[num_vertices] = (int)edges.size();
+	};
+	flatten(up, ch->up_begin, ch->up_edges);
+	flatten(down, ch->down_begin, ch->down_edges);
+
+	ch->_shortcuts = shortcuts;
+	ch->_build_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - start_time).count();
+	return ch;
+}
+
+bool ContractionHierarchy::query (QueryContext& ctx, Endpoint const* sources, int num_sources, Endpoint const* targets, int num_targets,
+		std::vector<int>* result_vertices, float* result_cost) const {
+	ZoneScoped;
+
+	ctx.begin_query(num_vertices());
+	ctx._iter = 0;
+
+	typedef std::pair<float, int> Queued;
+	std::priority_queue<Queued, std::vector<Queued>, std::greater<Queued>> fw_queue, bw_queue;
+
+	for (int i=0; i<num_sources; ++i) {
+		auto& s = ctx.get(ctx.fw, sources[i].vertex);
+		if (sources[i].cost < s.cost) {
+			s.cost = sources[i].cost;
+			fw_queue.push({ s.cost, sources[i].vertex });
+		}
+	}
+	for (int i=0; i<num_targets; ++i) {
+		auto& s = ctx.get(ctx.bw, targets[i].vertex);
+		if (targets[i].cost < s.cost) {
+			s.cost = targets[i].cost;
+			bw_queue.push({ s.cost, targets[i].vertex });
+		}
+	}
+
+	float best = INF;
+	int meet = -1;
+
+	// alternate by always advancing the direction with the lower cost
+	//  both searches only go upwards in rank, and meet at the highest ranked vertex of the path
+	while (!fw_queue.empty() || !bw_queue.empty()) {
+		float fw_min = fw_queue.empty() ? INF : fw_queue.top().first;
+		float bw_min = bw_queue.empty() ? INF : bw_queue.top().first;
+		if (min(fw_min, bw_min) >= best)
+			break; // neither direction can improve on best
+
+		bool forward = fw_min <= bw_min;
+		auto& queue        = forward ? fw_queue : bw_queue;
+		auto& states       = forward ? ctx.fw : ctx.bw;
+		auto& other_states = forward ? ctx.bw : ctx.fw;
+		auto& begin        = forward ? up_begin : down_begin;
+		auto& edges        = forward ? up_edges : down_edges;
+
+		int v = queue.top().second;
+		queue.pop();
+
+		auto& s = ctx.get(states, v);
+		if (s.settled) continue; // stale
+		s.settled = true;
+		ctx._iter++;
+
+		if (ctx.touched(other_states, v)) {
+			float total = s.cost + other_states[v].cost;
+			if (total < best) {
+				best = total;
+				meet = v;
+			}
+		}
+
+		for (int i=begin[v]; i<begin[v+1]; ++i) {
+			auto& e = edges[i];
+			auto& t = ctx.get(states, e.target);
+
+			float new_cost = s.cost + e.cost;
+			if (new_cost < t.cost) {
+				t.cost = new_cost;
+				t.pred = v;
+				t.pred_edge = i;
+				queue.push({ new_cost, e.target });
+			}
+		}
+	}
+
+	if (meet < 0)
+		return false; // no path found
+
+	*result_cost = best;
+
+	// forward half: source -> meet
+	std::vector<int> fw_chain; // up edge indices in reverse
+	int source = meet;
+	for (int v = meet; ctx.fw[v].pred >= 0; v = ctx.fw[v].pred) {
+		fw_chain.push_back(ctx.fw[v].pred_edge);
+		source = ctx.fw[v].pred;
+	}
+
+	result_vertices->push_back(source);
+	int cur = source;
+	for (int i=(int)fw_chain.size()-1; i>=0; --i) {
+		auto& e = up_edges[fw_chain[i]];
+		unpack_edge(cur, e.target, e.cost, e.mid, result_vertices);
+		cur = e.target;
+	}
+	assert(cur == meet);
+
+	// backward half: meet -> target, edge v -> pred is stored at pred
+	for (int v = meet; ctx.bw[v].pred >= 0; v = ctx.bw[v].pred) {
+		auto& e = down_edges[ctx.bw[v].pred_edge];
+		unpack_edge(v, ctx.bw[v].pred, e.cost, e.mid, result_vertices);
+	}
+
+	return true;
+}
+
+// Recursively replace shortcut from -> to by the edges from -> mid -> to it represents
+// appends all vertices after from, up to and including to
+void ContractionHierarchy::unpack_edge (int from, int to, float cost, int mid, std::vector<int>* vertices) const {
+	if (mid < 0) {
+		vertices->push_back(to);
+		return;
+	}
+
+	// mid was contracted before from and to, so from -> mid is a down edge of mid and mid -> to an up edge of mid
+	Edge const* first = nullptr;
+	Edge const* second = nullptr;
+	for (int i=down_begin[mid]; i<down_begin[mid+1]; ++i) {
+		if (down_edges[i].target == from) first = &down_edges[i];
+	}
+	for (int i=up_begin[mid]; i<up_begin[mid+1]; ++i) {
+		if (up_edges[i].target == to) second = &up_edges[i];
+	}
+	assert(first && second);
+
+	unpack_edge(from, mid, first->cost, first->mid, vertices);
+	unpack_edge(mid, to, second->cost, second->mid, vertices);
+}
+
+//// ContractionHierarchyBuilder
+void ContractionHierarchyBuilder::update (Network& net) {
+	ZoneScoped;
+
+	if (building) {
+		auto res = threadpool->results.try_pop();
+		if (res) {
+			ch = std::move((*res)->result);
+			building = false;
+		}
+	}
+
+	bool outdated = !ch || ch->version != version;
+	if (!building && outdated && !net.segments.empty()) {
+		if (!threadpool) {
+			threadpool = std::make_unique<Threadpool<Job>>(1, TPRIO_BACKGROUND, "contraction hierarchy thread");
+		}
+
+		auto job = std::make_unique<Job>();
+		job->graph = net.graph;
+		job->version = version;
+
+		threadpool->jobs.push_n(&job, 1);
+		building = true;
+	}
+}
+
+} // namespace network
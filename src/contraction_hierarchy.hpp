@@ -0,0 +1,146 @@
+#pragma once
+#include "common.hpp"
+#include "network.hpp"
+#include "turn_graph.hpp"
+#include "engine/kisslib/threadpool.hpp"
+
+namespace network {
+
+// Contraction hierarchy on the TurnGraph, vertices are contracted in order of importance (rank)
+//  and shortcuts are added to preserve shortest path costs between the remaining vertices
+// Queries are bidirectional dijkstras that only go upwards in rank, which visit only a tiny part of the graph
+class ContractionHierarchy {
+public:
+	struct Edge {
+		int   target; // up: higher ranked target, down: higher ranked source
+		float cost;
+		int   mid; // vertex bypassed by shortcut, -1 for original edge
+	};
+
+	// upward edges v -> higher ranked vertex, used by forward search
+	std::vector<int>  up_begin;
+	std::vector<Edge> up_edges;
+	// edges higher ranked vertex -> v, stored at v, used by backward search
+	std::vector<int>  down_begin;
+	std::vector<Edge> down_edges;
+
+	int version = -1; // network version this was built for
+
+	int   _shortcuts = 0;
+	float _build_time = 0; // seconds
+
+	int num_vertices () const { return (int)up_begin.size() - 1; }
+
+	static std::unique_ptr<ContractionHierarchy> build (TurnGraph const& graph);
+
+	struct Endpoint {
+		int   vertex;
+		float cost;
+	};
+
+	// Scratch state of a query, one per thread, lazily reset via generation counter like PathfindContext
+	struct QueryContext {
+		struct State {
+			uint32_t gen = 0;
+			float cost;
+			int   pred; // previous vertex in search direction, -1 for endpoints
+			int   pred_edge; // index into up_edges (forward) or down_edges (backward)
+			bool  settled;
+		};
+		std::vector<State> fw, bw;
+		uint32_t cur_gen = 0;
+
+		int _iter = 0; // settled vertices of last query
+
+		void begin_query (int num_vertices) {
+			if ((int)fw.size() != num_vertices) {
+				fw.assign(num_vertices, State{});
+				bw.assign(num_vertices, State{});
+				cur_gen = 0;
+			}
+
+			cur_gen++;
+			if (cur_gen == 0) { // wrapped around, need actual reset once
+				for (auto& s : fw) s.gen = 0;
+				for (auto& s : bw) s.gen = 0;
+				cur_gen = 1;
+			}
+		}
+		State& get (std::vector<State>& states, int v) {
+			auto& s = states[v];
+			if (s.gen != cur_gen) {
+				s = { cur_gen, INF, -1, -1, false };
+			}
+			return s;
+		}
+		bool touched (std::vector<State> const& states, int v) const {
+			return states[v].gen == cur_gen;
+		}
+
+		void mem_use (MemUse& mem) {
+			mem.add("ContractionHierarchy::QueryContext", MemUse::sizeof_alloc(fw) + MemUse::sizeof_alloc(bw));
+		}
+	};
+
+	// shortest path from any source to any target, result_vertices includes both
+	// sources and targets are assumed to be disjoint
+	bool query (QueryContext& ctx, Endpoint const* sources, int num_sources, Endpoint const* targets, int num_targets,
+			std::vector<int>* result_vertices, float* result_cost) const;
+
+	void mem_use (MemUse& mem) {
+		mem.add("ContractionHierarchy", MemUse::sizeof_alloc(up_begin) + MemUse::sizeof_alloc(up_edges) +
+			MemUse::sizeof_alloc(down_begin) + MemUse::sizeof_alloc(down_edges));
+	}
+
+private:
+	void unpack_edge (int from, int to, float cost, int mid, std::vector<int>* vertices) const;
+};
+
+// Keeps a ContractionHierarchy up to date with the network by rebuilding it on a background thread
+//  the network TurnGraph is copied on the main thread, so contraction does not touch the network
+class ContractionHierarchyBuilder {
+	struct Job {
+		TurnGraph graph;
+		int version;
+
+		std::unique_ptr<ContractionHierarchy> result;
+
+		// run on thread
+		void execute () {
+			ZoneScoped;
+			result = ContractionHierarchy::build(graph);
+			result->version = version;
+		}
+	};
+
+	// lazily created to keep Network movable
+	std::unique_ptr<Threadpool<Job>> threadpool = nullptr;
+	bool building = false;
+
+	int version = 0; // incremented on network change
+
+public:
+	// latest finished build, might be outdated
+	std::unique_ptr<ContractionHierarchy> ch = nullptr;
+
+	// call whenever the network TurnGraph was rebuilt
+	void invalidate () {
+		version++;
+	}
+
+	// pick up finished build and kick off rebuild if outdated
+	// must be called at a point where no pathfinding is running, since the hierarchy might get replaced
+	void update (Network& net);
+
+	// null if not built yet or outdated, pathfinding should fall back to regular search then
+	ContractionHierarchy* get_current () {
+		return ch && ch->version == version ? ch.get() : nullptr;
+	}
+	bool is_building () { return building; }
+
+	void mem_use (MemUse& mem) {
+		if (ch) ch->mem_use(mem);
+	}
+};
+
+} // namespace network
@@ -48,9 +48,9 @@ Person::Person (Assets& assets, Random& rand, Building* initial_building) {
 
 	stay_timer = rand.uniformf(0,1);
 }
-void Person::remove_vehicle (Vehicle* vehicle) {
+void Person::remove_vehicle (network::Network& net, Vehicle* vehicle) {
 	if (trip) {
-		trip->cancel_trip(*this);
+		trip->cancel_trip(*this, net);
 	}
 	else {
 		vehicle->parking = nullptr; // vehicle goes to owner's pocket!
@@ -7,6 +7,7 @@ namespace network {
 	class Node;
 	class Vehicle;
 	class PersonTrip;
+	class Network;
 }
 class Building;
 class Person;
@@ -16,7 +17,7 @@ using network::Vehicle;
 // Might change later!
 class IVehicleOwner {
 public:
-	virtual void remove_vehicle (Vehicle* vehicle) = 0;
+	virtual void remove_vehicle (network::Network& net, Vehicle* vehicle) = 0;
 };
 
 // Should this class be a series of parking spots instead?
@@ -143,7 +144,16 @@ public:
 	//Building* work = nullptr;
 	
 	Building* cur_building = nullptr;
+	// duration of stay in cur_building, Network::person_scheduler wakes the person afterwards
 	float stay_timer = 1;
+	// waiting in cur_building for pathfinding result of requested trip
+	bool trip_requested = false;
+	// index into Entities::persons, assigned on spawn
+	int _id = -1;
+	// index in Network::active_persons while on a trip
+	int _active_idx = -1;
+	// trips begun so far, to seed each trip's path
+	uint32_t _trip_count = 0;
 
 	std::unique_ptr<Vehicle> owned_vehicle;
 	std::unique_ptr<network::PersonTrip> trip;
@@ -168,7 +178,7 @@ public:
 	//	return { shape->pos, shape->radius, c };
 	//}
 
-	void remove_vehicle (Vehicle* vehicle) override;
+	void remove_vehicle (network::Network& net, Vehicle* vehicle) override;
 	
 	void mem_use (MemUse& mem) {
 		mem.add("Person", sizeof(*this));
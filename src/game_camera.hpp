@@ -2,8 +2,6 @@
 #include "common.hpp"
 #include "engine/camera.hpp"
 #include "entities.hpp"
-#include "network.hpp"
-#include "network_sim.hpp"
 
 struct GameCamera {
 	friend SERIALIZE_TO_JSON(GameCamera) {
@@ -186,33 +184,6 @@ struct CameraTrack {
 		ImGui::Checkbox("Track Rotation", &track_rot);
 	}
 
-	void update (GameCamera& cam, sel_ptr selection, float dt) {
-		auto* veh = selection.get<Vehicle*>();
-		auto pos = veh ? veh->calc_pos() : std::nullopt;
-		if (track && pos) { // If tracking and object selected
-			
-			if (cur_tracking != selection) {
-				// re-center camera if new selection or selection changed
-				pos_target = pos->pos; // jump to tracking target
-				smoothing_t = 0;
-			}
-			else {
-				pos_target += pos->pos - prev_pos.pos;
-				if (track_rot)
-					cam.rot_aer.x += pos->ang - prev_pos.ang;
-			}
-
-			// smoothly lerp from free camera to tracking target for smoothing_duration seconds
-			// NOTE: camera movement overridden entirely if CameraTrack::update is called after camera::update
-			cam.orbit_pos = lerp(cam.orbit_pos, pos_target, smoothing_t); // TODO: framereate dependent!!!
-			smoothing_t = min(smoothing_t + dt / smoothing_duration, 1.0f);
-
-			prev_pos = *pos;
-
-			cur_tracking = selection;
-		}
-		else {
-			cur_tracking = nullptr;
-		}
-	}
+	// defined in interact.cpp, needs Vehicle, which can't be included here (network_sim.hpp includes interact.hpp)
+	void update (GameCamera& cam, sel_ptr selection, float dt);
 };
@@ -0,0 +1,398 @@
+#include "common.hpp"
+#include "world.hpp"
+
+// Runs the simulation on a TestMapBuilder map without window, GL context or imgui, and prints timings of each tick pass as json
+// usage: city_builder --headless [grid_n=10] [persons_n=600] [seed=0] [ticks=3600] [warmup=60] [threads=-1] [out=file.json]
+//                                 [record=trace.bin | verify=trace.bin] [conflict_bench=0] [meso_dist=0]
+//    or: city_builder_headless [same args], built by CMakeLists.txt with HEADLESS, without window, renderer or GL (for Linux)
+//  assets are loaded from settings.json like in the app, network settings are the defaults so results are comparable
+//  output goes to stdout unless out is set, log/log_warn/log_error go to stderr so stdout is only the json report
+//  nothing is rendered, so no vehicle is visible and vehicle visuals (SimVehicle::Visuals) are never animated
+//  record writes a StateHash of every tick (including warmup) to a trace file, verify reruns and compares against one,
+//   reporting the first diverging tick and entity, exit code 2 on divergence
+//   this relies on the default settings being deterministic (no timing-based pathfinding budget or contraction hierarchy)
+//  conflict_bench=N times check_conflict against check_conflict_scalar N times over all connection pairs of the
+//   largest intersection of the map and checks that results are identical
+//  meso_dist>0 enables the mesoscopic LOD (Settings::MesoLOD) with the lod focus fixed at the center of the map
+
+struct HeadlessArgs {
+	int grid_n = 10;
+	int persons_n = 600;
+	int seed = 0;
+	int ticks = 3600;
+	int warmup = 60; // ticks before measuring, initial pathfinding of all persons is not representative
+	int threads = -1; // Settings::sim_threads
+	std::string out;
+	std::string record;
+	std::string verify;
+	int conflict_bench = 0;
+	float meso_dist = 0;
+
+	bool parse (int argc, char** argv) {
+		for (int i=0; i<argc; ++i) {
+			std::string_view arg = argv[i];
+			auto eq = arg.find('=');
+			if (eq == std::string_view::npos) {
+				log_error("headless: expected key=value, got %s\n", argv[i]);
+				return false;
+			}
+			auto key = arg.substr(0, eq);
+			std::string val = std::string(arg.substr(eq+1));
+
+			try {
+				if      (key == "grid_n"   ) grid_n    = std::stoi(val);
+				else if (key == "persons_n") persons_n = std::stoi(val);
+				else if (key == "seed"     ) seed      = std::stoi(val);
+				else if (key == "ticks"    ) ticks     = std::stoi(val);
+				else if (key == "warmup"   ) warmup    = std::stoi(val);
+				else if (key == "threads"  ) threads   = std::stoi(val);
+				else if (key == "out"      ) out       = val;
+				else if (key == "record"   ) record    = val;
+				else if (key == "verify"   ) verify    = val;
+				else if (key == "conflict_bench") conflict_bench = std::stoi(val);
+				else if (key == "meso_dist") meso_dist = std::stof(val);
+				else {
+					log_error("headless: unknown argument %s\n", argv[i]);
+					return false;
+				}
+			} catch (std::exception&) {
+				log_error("headless: invalid value in %s\n", argv[i]);
+				return false;
+			}
+		}
+		if (!record.empty() && !verify.empty()) {
+			log_error("headless: can't record and verify at the same time\n");
+			return false;
+		}
+		return true;
+	}
+};
+
+using network::StateHash;
+
+// Trace file: Header, then per tick: uint64 total, uint32 entity count, StateHash::Entity[count]
+class StateTrace {
+	struct Header {
+		char magic[8];
+		int grid_n, persons_n, seed;
+	};
+	static constexpr char MAGIC[8] = { 'S','I','M','T','R','A','C','E' };
+
+	FILE* file = nullptr;
+	bool writing;
+
+	StateHash recorded; // tick read back from file
+
+public:
+	// divergence found by verify
+	int diverged_tick = -1;
+	std::string diverged_entity;
+
+	~StateTrace () {
+		if (file) fclose(file);
+	}
+
+	bool open (const char* filename, bool write, HeadlessArgs const& args) {
+		writing = write;
+		file = fopen(filename, write ? "wb" : "rb");
+		if (!file) {
+			log_error("headless: could not open trace %s\n", filename);
+			return false;
+		}
+
+		Header header = {};
+		if (writing) {
+			memcpy(header.magic, MAGIC, sizeof(MAGIC));
+			header.grid_n    = args.grid_n;
+			header.persons_n = args.persons_n;
+			header.seed      = args.seed;
+			fwrite(&header, sizeof(header), 1, file);
+		}
+		else {
+			if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+				log_error("headless: %s is not a trace file\n", filename);
+				return false;
+			}
+			if (header.grid_n != args.grid_n || header.persons_n != args.persons_n || header.seed != args.seed) {
+				log_error("headless: trace was recorded with grid_n=%d persons_n=%d seed=%d\n",
+					header.grid_n, header.persons_n, header.seed);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void write (StateHash const& state) {
+		uint32_t count = (uint32_t)state.entities.size();
+		fwrite(&state.total, sizeof(state.total), 1, file);
+		fwrite(&count, sizeof(count), 1, file);
+		fwrite(state.entities.data(), sizeof(StateHash::Entity), count, file);
+	}
+
+	// returns false once diverged or the trace ended
+	bool verify (int tick, StateHash const& state) {
+		uint32_t count;
+		if (fread(&recorded.total, sizeof(recorded.total), 1, file) != 1 ||
+		    fread(&count, sizeof(count), 1, file) != 1) {
+			log_warn("headless: trace ended at tick %d, stopped verifying\n", tick);
+			return false;
+		}
+		recorded.entities.resize(count);
+		if (fread(recorded.entities.data(), sizeof(StateHash::Entity), count, file) != count) {
+			log_warn("headless: trace truncated at tick %d, stopped verifying\n", tick);
+			return false;
+		}
+
+		if (recorded.total == state.total)
+			return true;
+		
+		diverged_tick = tick;
+		diverged_entity = find_diverged_entity(state);
+		log_error("headless: diverged at tick %d in %s\n", tick, diverged_entity.c_str());
+		return false;
+	}
+
+	std::string find_diverged_entity (StateHash const& state) {
+		auto str = [] (StateHash::Entity const& e) {
+			return prints("%s %d", StateHash::entity_type_str[e.type], e.id);
+		};
+		// entities are in update order, so the first mismatch is the earliest difference
+		size_t count = std::min(recorded.entities.size(), state.entities.size());
+		for (size_t i=0; i<count; ++i) {
+			auto& a = recorded.entities[i];
+			auto& b = state.entities[i];
+			if (a.type != b.type || a.id != b.id)
+				return prints("update order (recorded %s, got %s)", str(a).c_str(), str(b).c_str());
+			if (a.hash != b.hash)
+				return str(b);
+		}
+		return prints("entity count (recorded %d, got %d)", (int)recorded.entities.size(), (int)state.entities.size());
+	}
+};
+
+json bench_conflicts (Network& net, int reps) {
+	using namespace network;
+
+	Node* node = nullptr;
+	for (auto& other : net.nodes) {
+		if (!node || other->_conns.size() > node->_conns.size())
+			node = other.get();
+	}
+	if (!node) return {};
+
+	auto& conns = node->_conns;
+	int n = (int)conns.size();
+	int pairs = n*(n-1)/2;
+
+	bool identical = true;
+	for (int a=1; a<n; ++a)
+	for (int b=0; b<a; ++b) {
+		auto l = check_conflict(conns[a], conns[b]);
+		auto r = check_conflict_scalar(conns[a], conns[b]);
+		identical = identical && memcmp(&l, &r, sizeof(Conflict)) == 0;
+	}
+
+	auto measure = [&] (auto func) {
+		float sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i=0; i<reps; ++i)
+		for (int a=1; a<n; ++a)
+		for (int b=0; b<a; ++b) {
+			sum += func(conns[a], conns[b]).a_t1;
+		}
+		float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		volatile float sink = sum; // keep results alive
+		(void)sink;
+		return reps*pairs > 0 ? elapsed / (float)(reps*pairs) * 1e9f : 0;
+	};
+	float scalar_ns = measure(check_conflict_scalar);
+	float simd_ns   = measure(check_conflict);
+
+	json j;
+	j["node"]        = node->_id;
+	j["connections"] = n;
+	j["pairs"]       = pairs;
+	j["scalar_ns"]   = scalar_ns;
+	j["simd_ns"]     = simd_ns;
+	j["speedup"]     = simd_ns > 0 ? scalar_ns / simd_ns : 0;
+	j["identical"]   = identical;
+	return j;
+}
+
+struct PassStats {
+	double total = 0;
+	float max = 0;
+
+	void add (float t) {
+		total += t;
+		max = std::max(max, t);
+	}
+	json to_json (int ticks) const {
+		json j;
+		j["avg_ms"] = ticks > 0 ? total / ticks * 1000 : 0;
+		j["max_ms"] = max * 1000;
+		j["total_ms"] = total * 1000;
+		return j;
+	}
+};
+
+int run_headless (int argc, char** argv) {
+	log_file = stderr;
+
+	HeadlessArgs args;
+	if (!args.parse(argc, argv))
+		return 1;
+
+	Input input; // never updated, only needed for Interaction
+	World world{input};
+
+	SavefileIO::load(SavefileIO::app_settings_json, [&] (json const& j) { auto& t = world;
+		SERIALIZE_FROM_JSON_EXPAND(assets, options)
+	});
+	if (world.assets.buildings.set.empty() || world.assets.networks.set.empty()) {
+		log_error("headless: no assets loaded from %s\n", SavefileIO::app_settings_json);
+		return 1;
+	}
+
+	auto& net = world.network;
+	auto& builder = world.test_map_builder;
+	builder._grid_n = args.grid_n;
+	builder._persons_n = args.persons_n;
+	builder._seed = args.seed;
+	builder.spawn(world.assets, world.entities, net, world.interact, world.sim_rand, true, true);
+
+	net.settings.sim_threads = args.threads;
+	float dt = net.settings.tick_dt;
+
+	if (args.meso_dist > 0) {
+		net.settings.meso.enable = true;
+		net.settings.meso.dist = args.meso_dist;
+
+		float3 center = 0;
+		for (auto& node : net.nodes)
+			center += node->pos;
+		net.lod_focus = center / max((float)net.nodes.size(), 1.0f);
+	}
+
+	json conflict_bench;
+	if (args.conflict_bench > 0)
+		conflict_bench = bench_conflicts(net, args.conflict_bench);
+
+	std::unique_ptr<StateTrace> trace;
+	if (!args.record.empty() || !args.verify.empty()) {
+		bool write = !args.record.empty();
+		trace = std::make_unique<StateTrace>();
+		if (!trace->open(write ? args.record.c_str() : args.verify.c_str(), write, args))
+			return 1;
+	}
+	StateHash state;
+	bool verifying = !args.verify.empty();
+	int tick = 0;
+
+	auto trace_tick = [&] () {
+		if (trace) {
+			net.hash_state(state);
+			if (!args.record.empty()) trace->write(state);
+			else if (verifying)       verifying = trace->verify(tick, state);
+		}
+		tick++;
+	};
+
+	struct Pass {
+		const char* name;
+		float Network::PassTimings::* time;
+	};
+	Pass passes[] = {
+		{ "init",        &Network::PassTimings::init },
+		{ "segments",    &Network::PassTimings::segments },
+		{ "nodes",       &Network::PassTimings::nodes },
+		{ "final_pass",  &Network::PassTimings::final_pass },
+		{ "animation",   &Network::PassTimings::animation },
+		{ "pathfinding", &Network::PassTimings::pathfinding },
+	};
+	PassStats pass_stats[ARRLEN(passes)];
+	PassStats tick_stats;
+
+	for (int i=0; i<args.warmup; ++i) {
+		net.tick(world, dt);
+		trace_tick();
+	}
+
+	for (int i=0; i<args.ticks; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		net.tick(world, dt);
+		tick_stats.add(std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count());
+
+		for (int p=0; p<ARRLEN(passes); ++p)
+			pass_stats[p].add(net._last_timings.*passes[p].time);
+
+		trace_tick();
+	}
+
+	json j;
+	j["scenario"]["grid_n"]    = args.grid_n;
+	j["scenario"]["persons_n"] = args.persons_n;
+	j["scenario"]["seed"]      = args.seed;
+	j["scenario"]["ticks"]     = args.ticks;
+	j["scenario"]["warmup"]    = args.warmup;
+	j["scenario"]["tick_dt"]   = dt;
+	j["scenario"]["threads"]   = args.threads;
+	j["scenario"]["meso_dist"] = args.meso_dist;
+	j["scenario"]["nodes"]     = (int)net.nodes.size();
+	j["scenario"]["segments"]  = (int)net.segments.size();
+
+	j["tick"] = tick_stats.to_json(args.ticks);
+	for (int p=0; p<ARRLEN(passes); ++p)
+		j["passes"][passes[p].name] = pass_stats[p].to_json(args.ticks);
+
+	j["final"]["active_persons"] = (int)net.active_persons.size();
+	j["final"]["avg_flow"]       = net.metrics.avg_flow;
+	{
+		int sleeping = 0;
+		for (auto* person : net.active_persons)
+			if (person->owned_vehicle->sim->sleeping) sleeping++;
+		j["final"]["sleeping_vehicles"] = sleeping;
+	}
+	if (args.meso_dist > 0) {
+		int meso = 0, queued = 0;
+		for (auto* person : net.active_persons) {
+			if (person->owned_vehicle->sim->meso) meso++;
+			if (person->owned_vehicle->sim->meso_queued) queued++;
+		}
+		j["final"]["meso_vehicles"] = meso;
+		j["final"]["meso_queued_vehicles"] = queued; // not stepped this tick
+	}
+
+	if (args.conflict_bench > 0)
+		j["conflict_bench"] = conflict_bench;
+
+	bool diverged = trace && trace->diverged_tick >= 0;
+	if (!args.verify.empty()) {
+		j["verify"]["diverged"] = diverged;
+		if (diverged) {
+			j["verify"]["tick"]   = trace->diverged_tick;
+			j["verify"]["entity"] = trace->diverged_entity;
+		}
+	}
+
+	if (!args.out.empty()) {
+		save_json(args.out.c_str(), j);
+	}
+	else {
+		printf("%s\n", j.dump(1, '\t').c_str());
+	}
+	return diverged ? 2 : 0;
+}
+
+#if HEADLESS
+#if OGL_USE_REVERSE_DEPTH
+namespace ogl {
+	bool reverse_depth = true; // declared in common.hpp, normally defined by the GL backend
+}
+#endif
+
+// main.cpp (Engine) is not part of the headless build
+int main (int argc, char** argv) {
+	return run_headless(argc-1, argv+1);
+}
+#endif
@@ -1,6 +1,5 @@
 #include "common.hpp"
 #include "interact.hpp"
-#include "app.hpp"
 #include "terrain.hpp"
 #include "entities.hpp"
 #include "network.hpp"
@@ -68,6 +67,8 @@ class BuildTools : public ToolshelfTool {
 				auto* node = I.hover.get<network::Node*>();
 				if (node) {
 					node->toggle_traffic_light();
+					I.network.invalidate_graph(); // traffic light penalty is baked into graph costs
+					I.network.path_cache.invalidate(node);
 					I.entities.buildings_changed = true; // TODO: make more efficient, or refactor at least?
 				}
 			}
@@ -88,7 +89,7 @@ public:
 		I.find_hover(false);
 		
 		if (I.input.buttons[MOUSE_BUTTON_LEFT].went_down) {
-			Interaction::remove_entity(I.hover);
+			I.remove_entity(I.hover);
 		}
 	}
 };
@@ -118,7 +119,7 @@ void Interaction::_add_tools () {
 void Interaction::remove_entity (sel_ptr& entity) {
 	auto* veh = entity.get<Vehicle*>();
 	if (veh) {
-		veh->owner->remove_vehicle(veh);
+		veh->owner->remove_vehicle(network, veh);
 		entity = nullptr;
 	}
 }
@@ -133,7 +134,7 @@ void Interaction::imgui () {
 	ImGui::PopID();
 }
 
-void Interaction::update (App& app, View3D& view) {
+void Interaction::update () {
 	ZoneScoped;
 	
 	hover = nullptr;
@@ -146,7 +147,7 @@ void Interaction::update (App& app, View3D& view) {
 	//	switch_to_tool(app, tools[0].get());
 	//}
 
-	if (app.input.buttons[KEY_DELETE].went_down) {
+	if (input.buttons[KEY_DELETE].went_down) {
 		remove_entity(selection);
 	}
 
@@ -225,3 +226,33 @@ void Interaction::find_hover (bool only_net) { // TODO: create a mask for this
 		}
 	}
 }
+
+void CameraTrack::update (GameCamera& cam, sel_ptr selection, float dt) {
+	auto* veh = selection.get<Vehicle*>();
+	auto pos = veh ? veh->calc_pos() : std::nullopt;
+	if (track && pos) { // If tracking and object selected
+		
+		if (cur_tracking != selection) {
+			// re-center camera if new selection or selection changed
+			pos_target = pos->pos; // jump to tracking target
+			smoothing_t = 0;
+		}
+		else {
+			pos_target += pos->pos - prev_pos.pos;
+			if (track_rot)
+				cam.rot_aer.x += pos->ang - prev_pos.ang;
+		}
+
+		// smoothly lerp from free camera to tracking target for smoothing_duration seconds
+		// NOTE: camera movement overridden entirely if CameraTrack::update is called after camera::update
+		cam.orbit_pos = lerp(cam.orbit_pos, pos_target, smoothing_t); // TODO: framereate dependent!!!
+		smoothing_t = min(smoothing_t + dt / smoothing_duration, 1.0f);
+
+		prev_pos = *pos;
+
+		cur_tracking = selection;
+	}
+	else {
+		cur_tracking = nullptr;
+	}
+}
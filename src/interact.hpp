@@ -3,11 +3,11 @@
 #include "util.hpp"
 #include "game_camera.hpp"
 
-class App;
 class Interaction;
 class ToolshelfTool;
 class Heightmap;
-class Network;
+namespace network { class Network; }
+using network::Network;
 class Entities;
 
 // Basic toggle tool, keeps its own active state and users receive (de)activation and update events
@@ -207,7 +207,7 @@ public:
 
 	void imgui ();
 
-	void update (App& app, View3D& view);
+	void update ();
 	
 	Interaction (Input& input, View3D& view, Assets& assets, Heightmap& heightmap, Network& network, Entities& entities):
 	             input{input}, view{view}, assets{assets}, heightmap{heightmap}, network{network}, entities{entities} {
@@ -242,5 +242,5 @@ public:
 		}
 	}
 
-	static void remove_entity (sel_ptr& entity);
+	void remove_entity (sel_ptr& entity);
 };
@@ -1,8 +1,12 @@
 #include "common.hpp"
 
 Engine* new_app ();
+int run_headless (int argc, char** argv);
+
+int main (int argc, char** argv) {
+	if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+		return run_headless(argc-2, argv+2);
 
-int main () {
 	log("Starting application...\n");
 	Engine* app = new_app();
 	int ret = app->main_loop();
@@ -1,7 +1,7 @@
 #include "common.hpp"
 #include "network.hpp"
 #include "network_sim.hpp"
-#include "app.hpp"
+#include "world.hpp"
 
 namespace network {
 
@@ -197,8 +197,23 @@ void Node::update_cached (float additional_node_radius) {
 		return ang_l < ang_r;
 	});
 
+	int n = (int)segments.size();
+	assert(n <= 256);
+	for (int i=0; i<n; ++i) {
+		auto* seg = segments[i];
+		if (seg->node_a == this) seg->_slot_a = (uint8_t)i;
+		else                     seg->_slot_b = (uint8_t)i;
+	}
+
 	default_node_segment_pos(this, additional_node_radius);
 
+	// classify turns once, needs segment tangents set by default_node_segment_pos
+	_turns.resize(n*n);
+	for (int in=0; in<n; ++in)
+	for (int out=0; out<n; ++out) {
+		_turns[in*n + out] = calc_turn(this, segments[in], segments[out]);
+	}
+
 	_radius = 0;
 	for (auto* seg : segments) {
 		auto info = seg->get_end_info(seg->get_dir_to_node(this));
@@ -302,8 +317,77 @@ void setup_traffic_light_2phase (TrafficLight& light, Node* node) {
 }
 
 TrafficLight::TrafficLight (Node* node) {
+	update_signal_slots(node);
+
 	//setup_traffic_light_exclusive_segments(*this, node);
 	setup_traffic_light_2phase(*this, node);
 }
+void TrafficLight::update_signal_slots (Node* node) {
+	_seg_signal_slots.resize(node->segments.size());
+
+	int signal_slot = 0;
+	for (int seg_i=0; seg_i<(int)node->segments.size(); ++seg_i) {
+		_seg_signal_slots[seg_i] = signal_slot;
+		signal_slot += node->segments[seg_i]->in_lanes(node).count();
+	}
+}
+
+////
+void Network::update_cached () {
+	for (int i=0; i<(int)nodes.size(); ++i) {
+		nodes[i]->_id = i;
+	}
+	for (int i=0; i<(int)segments.size(); ++i) {
+		segments[i]->_id = i;
+	}
+
+	_max_speed_limit = 0;
+	for (auto& seg : segments) {
+		_max_speed_limit = max(_max_speed_limit, seg->asset->speed_limit);
+	}
+
+	{ // greedy graph coloring, neighbours share lanes (avail_space) and vehicles on them, so must not be updated concurrently
+		std::vector<int> color(nodes.size(), -1);
+		std::vector<bool> used;
+		
+		_node_colors.clear();
+		for (auto& node : nodes) {
+			used.assign(_node_colors.size(), false);
+			for (auto* seg : node->segments) {
+				int c = color[seg->get_other_node(node.get())->_id];
+				if (c >= 0) used[c] = true;
+			}
+
+			int c = 0;
+			while (c < (int)used.size() && used[c]) c++;
+			if (c == (int)_node_colors.size())
+				_node_colors.emplace_back();
+
+			color[node->_id] = c;
+			_node_colors[c].push_back(node.get());
+		}
+	}
+
+	{
+		ZoneScopedN("conflict tables");
+		// nodes only write their own tables
+		sim_threads.for_chunks(sim_thread_count(), (int)nodes.size(), [&] (int chunk, int i0, int i1) {
+			for (int i=i0; i<i1; ++i) {
+				nodes[i]->update_conflicts();
+			}
+		});
+	}
+
+	// vertex ids depend on segment ids, so can't wait for next pathfinding batch
+	rebuild_graph();
+	path_cache.clear();
+}
+void Network::rebuild_graph () {
+	graph.build(*this, settings.pathfinding.avoid_traffic_lights);
+	_graph_dirty = false;
+	_graph_version++;
+
+	ch.invalidate();
+}
 
 } // namespace network
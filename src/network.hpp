@@ -70,13 +70,6 @@ struct Connection {
 	SegLane a;
 	SegLane b;
 	
-	// arbitrary order so we can treat b->a as a->b for Conflict cache
-	bool operator< (Connection const& other) const {
-		if      (a.seg  != other.a.seg ) return a.seg  < other.a.seg ;
-		else if (b.seg  != other.b.seg ) return b.seg  < other.b.seg ;
-		else if (a.lane != other.a.lane) return a.lane < other.a.lane; // Could combine lane < by merging ints
-		else                             return b.lane < other.b.lane;
-	}
 	bool operator== (Connection const& other) const {
 		return a == other.a && b == other.b;
 	}
@@ -88,20 +81,6 @@ VALUE_HASHER(Connection,
 	t.a.seg, t.b.seg,
 	hash_get_bits(t.a.lane, t.b.lane));
 
-struct ConflictKey {
-	Connection a, b;
-	
-	bool operator== (ConflictKey const& other) const {
-		return a == other.a && b == other.b;
-	}
-	bool operator!= (ConflictKey const& other) const {
-		return !(*this == other);
-	}
-};
-VALUE_HASHER(ConflictKey,
-	t.a.a.seg , t.a.b.seg , t.b.a.seg , t.b.b.seg ,
-	hash_get_bits(t.a.a.lane, t.a.b.lane, t.b.a.lane, t.b.b.lane));
-
 struct Conflict {
 	float a_t0 = INF;
 	float a_t1 = -INF;
@@ -117,10 +96,12 @@ struct CachedConnection {
 	Connection conn; // This is unnecessary, can be read from PathState
 	Bezier3 bezier;
 	float bez_len; // This is related to the NodeVehicle k values, which are going to be changed soon
+	int idx = -1; // index into Node::_conns, -1 if not one of the node's lane connections
+	float speed_limit; // see get_curve_speed_limit
 };
 
 template <typename T>
-struct VehicleList { // TODO: optimize vehicles in lane to only look at vehicle in front of them, and speed up insert/erase by using linked list
+struct VehicleList { // TODO: speed up insert/erase by using linked list
 	std::vector<T> list;
 
 	// TODO: can we avoid needing this?
@@ -212,19 +193,49 @@ struct NodeVehicle {
 	}
 };
 
+// Vehicles in lane ordered from lane end to lane start, ie. front is the first vehicle to leave the lane
+// Intrusive doubly-linked list, links are stored in SimVehicle (lane_prev is the vehicle in front, lane_next the one behind)
+// so each vehicle can directly look at its leader and insert/remove are O(1)
 struct LaneVehicles {
 	void mem_use (MemUse& mem) {
-		mem.add("LaneVehicles", sizeof(*this) + MemUse::sizeof_alloc(list.list));
+		mem.add("LaneVehicles", sizeof(*this));
 	}
 
-	VehicleList<Vehicle*> list;
+	Vehicle* head = nullptr;
+	Vehicle* tail = nullptr;
+	int count = 0;
+
 	float avail_space;
+	// speed limit factor for mesoscopic vehicles from lane occupancy, see Settings::MesoLOD
+	float meso_speed_fac = 1;
+
+	bool empty () const { return head == nullptr; }
+	Vehicle* front () const { return head; }
+	Vehicle* back () const { return tail; }
 	
-	// find index in list of vehicles such all vehicles of indices below return value have
-	// rear bezier t > bez_t
-	// this is the correct index for insertion
+	// insert veh behind leading, or at front if leading is null
+	void insert_after (Vehicle* veh, Vehicle* leading);
+	void remove (Vehicle* veh);
+	bool try_remove (Vehicle* veh);
+	// unlinks all vehicles
+	void clear ();
+
+	// true if a is in front of b, both in this lane
+	bool is_ahead (Vehicle* a, Vehicle* b) const;
+
+	struct Iterator {
+		Vehicle* cur;
+
+		Vehicle* operator* () const { return cur; }
+		Iterator& operator++ ();
+		bool operator!= (Iterator const& other) const { return cur != other.cur; }
+	};
+	Iterator begin () const { return { head }; }
+	Iterator end () const { return { nullptr }; }
+	
+	// find spot in lane such all vehicles before the spot have rear bezier t > bez_t
+	// this is the correct spot for insertion
 	struct FindResult {
-		int idx;
 		Vehicle* leading = nullptr;
 		Vehicle* trailing = nullptr;
 	};
@@ -245,14 +256,12 @@ struct SegVehicles {
 struct NodeVehicles {
 	void mem_use (MemUse& mem) {
 		mem.add("NodeVehicles", sizeof(*this) + MemUse::sizeof_alloc(test.list));
-		mem.add("NodeVehicles::Hashmap", MemUse::sizeof_alloc(conflict_cache));
 	}
 
 	//VehicleList<SimVehicle*> free;
 	VehicleList<NodeVehicle> test;
-
-	// TODO: switch to that one flat hashmap i added to the project and profile?
-	Hashmap<ConflictKey, Conflict, ConflictKeyHasher> conflict_cache;
+	// vehicles removed from test by update_node this tick, forgotten by the vehicles after the node pass (see SimVehicle::tracking_node)
+	std::vector<Vehicle*> dropped;
 };
 
 class Node {
@@ -260,6 +269,9 @@ public:
 	void mem_use (MemUse& mem) {
 		mem.add("Node", sizeof(*this));
 		mem.add("Node::segments", MemUse::sizeof_alloc(segments));
+		mem.add("Node::_turns", MemUse::sizeof_alloc(_turns));
+		mem.add("Node::_conns", MemUse::sizeof_alloc(_conns) + MemUse::sizeof_alloc(_seg_in_lanes) + MemUse::sizeof_alloc(_in_lane_conns));
+		mem.add("Node::_conflicts", MemUse::sizeof_alloc(_conflicts));
 		// TODO: traffic_light
 		vehicles.mem_use(mem);
 	}
@@ -276,14 +288,34 @@ public:
 	// Sorted CCW in update_cached() for good measure
 	std::vector<Segment*> segments;
 
-	// for Dijkstra, TODO: remove this from this data structure! indices instead of pointers needed to be able to have seperate node lists?
-	// else always need to map pointers to other pointers or indices
-	float    _cost;
-	bool     _visited;
-	int      _q_idx;
+	// turn classification of every in -> out segment pair, indexed by [in slot * segments.size() + out slot]
+	// computed once in update_cached(), use classify_turn()
+	std::vector<Turns> _turns;
+
+	// index into Network::nodes, assigned in Network::update_cached()
+	// used to index per-node data outside of node
+	int _id = -1;
 
-	Node*    _pred;
-	Segment* _pred_seg;
+	// every lane connection through the node with its curve, length and speed limit, in order of segments, incoming lanes, then lane connections
+	// computed with the conflict table in update_conflicts(), use get_conn()
+	std::vector<CachedConnection> _conns;
+	// conflict of every pair of _conns, lower triangle indexed by [a*(a-1)/2 + b] for a > b, stored as a vs b
+	std::vector<Conflict> _conflicts;
+
+	// index of first incoming lane of each segment (by Segment::get_slot), incoming lanes numbered in order of segments
+	std::vector<int> _seg_in_lanes;
+	// index of first _conns entry of each incoming lane, plus end
+	std::vector<int> _in_lane_conns;
+
+	// call after lane connections changed, Network::update_cached() does this for all nodes
+	void update_conflicts ();
+	// every lane connection through the node with its curve, in _conns order
+	std::vector<CachedConnection> calc_conns ();
+
+	// index into _conns, -1 if not one of the lane connections
+	int find_conn (Connection const& conn) const;
+	// cached connection, computed if not one of the lane connections (which can happen for vehicles while connections are edited)
+	CachedConnection get_conn (SegLane const& in, SegLane const& out);
 
 	bool _fully_dedicated_turns = false; // TODO: do this differently in the future
 	
@@ -357,6 +389,10 @@ public:
 	Node* node_a;
 	Node* node_b;
 
+	// index of this segment in node_a->segments and node_b->segments, assigned in Node::update_cached()
+	uint8_t _slot_a = 0;
+	uint8_t _slot_b = 0;
+
 	float3 pos_a;
 	float3 pos_b;
 
@@ -385,6 +421,10 @@ public:
 
 	float _length = 0;
 
+	// index into Network::segments, assigned in Network::update_cached()
+	// TurnGraph vertices are _id*2 + direction
+	int _id = -1;
+
 	SegVehicles vehicles;
 
 	std::vector<Lane> lanes;
@@ -400,6 +440,11 @@ public:
 		return dir == LaneDir::FORWARD ? node_b : node_a;
 	}
 	
+	int get_slot (Node const* node) const {
+		assert(node && (node == node_a || node == node_b));
+		return node_a == node ? _slot_a : _slot_b;
+	}
+
 	LaneDir get_dir_to_node (Node const* node) const {
 		assert(node && (node == node_a || node == node_b));
 		return node_a != node ? LaneDir::FORWARD : LaneDir::BACKWARD;
@@ -624,21 +669,8 @@ inline Bezier3 SegLane::_bezier () const {
 	return bez;
 }
 
-// max lanes/segment and max segments per node == 256
-inline uint32_t conn_id (Node* node, Connection const& conn) {
-	int a_idx = indexof(node->segments, conn.a.seg); // TODO: optimize this? or just cache conn_id of cars instead?
-	int b_idx = indexof(node->segments, conn.b.seg);
-
-	uint32_t a = (uint32_t)a_idx | ((uint32_t)conn.a.lane << 8);
-	uint32_t b = (uint32_t)b_idx | ((uint32_t)conn.b.lane << 8);
-
-	return a | (b << 16);
-}
-inline uint64_t conn_pair_id (uint32_t conn_a_id, uint32_t conn_b_id) {
-	return (uint64_t)conn_a_id | ((uint64_t)conn_b_id << 32);
-}
-
-inline Turns classify_turn (Node* node, Segment* in, Segment* out) {
+// turn geometry, only used to fill Node::_turns
+inline Turns calc_turn (Node* node, Segment* in, Segment* out) {
 	auto seg_dir_to_node = [] (Node* node, Segment* seg) {
 		return seg->get_dir_to_node(node) == LaneDir::FORWARD ?
 			seg->tangent_b() : seg->tangent_a();
@@ -657,6 +689,11 @@ inline Turns classify_turn (Node* node, Segment* in, Segment* out) {
 	else if (rel.x < 0.0f)  return Turns::LEFT;
 	else                    return Turns::RIGHT;
 }
+inline Turns classify_turn (Node* node, Segment* in, Segment* out) {
+	int n = (int)node->segments.size();
+	assert((int)node->_turns.size() == n*n);
+	return node->_turns[in->get_slot(node) * n + out->get_slot(node)];
+}
 inline bool is_turn_allowed (Node* node, Segment* in, Segment* out, Turns allowed) {
 	return (classify_turn(node, in, out) & allowed) != Turns::NONE;
 }
@@ -682,8 +719,14 @@ struct TrafficLight {
 	// bitmasks of active lanes per phase, limit lanes in node to max 64
 	std::unique_ptr<uint64_t[]> phases = nullptr;
 
+	// signal slots are numbered in order of segments, then in order of incoming lanes
+	// first signal slot of each segment (indexed by Segment::get_slot), rebuilt with the light since it depends on the lanes
+	std::vector<int> _seg_signal_slots;
+
 	TrafficLight (Node* node);
 
+	void update_signal_slots (Node* node);
+
 	void update (Node* node, float dt) {
 		timer += dt / phase_total_dur();
 		timer = fmodf(timer, (float)num_phases);
@@ -722,16 +765,22 @@ struct TrafficLight {
 		return RED;
 	}
 
+	int get_signal_slot (Node* node, SegLane const& lane) {
+		auto in_lanes = lane.seg->in_lanes(node);
+		assert(in_lanes.contains(lane));
+		return _seg_signal_slots[lane.seg->get_slot(node)] + (lane.lane - in_lanes.first);
+	}
+
 	// In order of segments, then in order of incoming lanes
 	template <typename T>
 	void push_signal_colors (Node* node, std::vector<T>& signal_colors) {
 		auto cur_phase = decode_phase();
 
-		int signal_slot = 0;
 		for (int seg_i=0; seg_i<(int)node->segments.size(); ++seg_i) {
 			auto& seg = node->segments[seg_i];
 			auto* light_asset = seg->asset->traffic_light_props.get();
 
+			int signal_slot = _seg_signal_slots[seg_i];
 			for (auto in_lane : seg->in_lanes(node)) {
 				auto state = get_signal(cur_phase, signal_slot);
 
@@ -744,21 +793,6 @@ struct TrafficLight {
 			}
 		}
 	}
-
-	// usages probably should be optimized!
-	static int _find_signal_slot (Node* node, SegLane& lane) {
-		int signal_slot = 0;
-		for (int seg_i=0; seg_i<(int)node->segments.size(); ++seg_i) {
-			auto& seg = node->segments[seg_i];
-			for (auto in_lane : seg->in_lanes(node)) {
-				if (lane == in_lane)
-					return signal_slot;
-				signal_slot++;
-			}
-		}
-		assert(false);
-		return 0;
-	}
 };
 
 struct Metrics {
@@ -787,12 +821,21 @@ struct Metrics {
 	}
 };
 struct Settings {
-	SERIALIZE(Settings, car_accel, car_deccel, car_rear_drag_ratio, intersec_heur, suspension, pathfinding);
+	SERIALIZE(Settings, car_accel, car_deccel, car_rear_drag_ratio, tick_dt, max_substeps, sim_threads, intersec_heur, suspension, pathfinding, meso);
 	
 	float car_accel = 4.5f;
 	float car_deccel = 5;
 
 	float car_rear_drag_ratio = 0.4f;
+
+	// fixed sim timestep, frames run as many ticks as sim time passed, vehicle positions are interpolated for rendering
+	float tick_dt = 1.0f / 60;
+	// at most this many ticks per frame, sim runs slower than target_gamespeed beyond that instead of spiraling
+	int max_substeps = 8;
+
+	// worker threads for segment, node and vehicle animation updates, -1 for hardware thread count, 0 or 1 runs on main thread
+	// results are identical for any thread count
+	int sim_threads = -1;
 	
 	struct SuspensionVisuals {
 		SERIALIZE(SuspensionVisuals, max, spring_k, spring_damp, accel_fac);
@@ -818,10 +861,45 @@ struct Settings {
 	} intersec_heur;
 
 	struct Pathfinding {
-		SERIALIZE(Pathfinding, avoid_traffic_lights);
+		SERIALIZE(Pathfinding, avoid_traffic_lights, astar, radix_heap, async, frame_budget_iter, frame_budget_us, contraction_hierarchy, path_cache_size);
 
 		float avoid_traffic_lights = 0; // factor to scale approximate wait times for pathfinding cost
+
+		// use A* with straight line distance / max speed limit heuristic, plain dijkstra if false
+		bool astar = true;
+
+		// radix heap instead of binary heap for queue, costs quantized to ms, so paths can differ within that tolerance
+		bool radix_heap = false;
+
+		// solve trip pathfinding on threadpool in the background, else on main thread (same results either way)
+		bool async = true;
+
+		// per-frame budget for solving trip pathfinding on the main thread (!async), long queries are resumed next frame
+		// bounds worst case frame time, 0 for both solves all requests immediately
+		int frame_budget_iter = 0; // visited vertices, deterministic
+		int frame_budget_us = 0; // microseconds, results depend on timing
+
+		// query contraction hierarchy, which is rebuilt in the background after changes, regular search while outdated
+		bool contraction_hierarchy = false;
+
+		// max number of trip paths kept in PathCache, 0 to disable
+		int path_cache_size = 4096;
 	} pathfinding;
+
+	// level of detail: vehicles far from the camera advance through lanes as queues (mesoscopic)
+	// instead of the full model (no acceleration, curvature or suspension, no conflict yielding among each other at nodes)
+	// once clear of the node they came from, they are not stepped until they reach the front of the lane queue
+	// and the time to drive the lane at lane speed passed, then drive the end of the lane and the node stepped again
+	struct MesoLOD {
+		SERIALIZE(MesoLOD, enable, dist, hysteresis, min_speed_fac);
+
+		bool enable = false;
+		// vehicles switch to mesoscopic beyond dist*hysteresis and back to full simulation within dist
+		float dist = 400;
+		float hysteresis = 1.1f;
+		// lane speed is speed limit * (1 - occupancy) (linear speed-density relation), but at least this fraction
+		float min_speed_fac = 0.1f;
+	} meso;
 	
 	void imgui () {
 		if (!imgui_Header("Network Settings")) return;
@@ -830,6 +908,10 @@ struct Settings {
 		ImGui::SliderFloat("car_deccel (m/s^2)", &car_deccel, 0, 20);
 
 		ImGui::SliderFloat("car_rear_drag_ratio", &car_rear_drag_ratio, 0, 1);
+
+		ImGui::SliderFloat("tick_dt", &tick_dt, 1.0f/240, 1.0f/10);
+		ImGui::SliderInt("max_substeps", &max_substeps, 1, 64);
+		ImGui::SliderInt("sim_threads", &sim_threads, -1, 64);
 		
 		if (ImGui::TreeNode("Suspension Visuals")) {
 			ImGui::SliderAngle("max.x", &suspension.max.x, 0, +30);
@@ -855,6 +937,21 @@ struct Settings {
 		
 		if (ImGui::TreeNode("Pathfinding")) {
 			ImGui::DragFloat("avoid_traffic_lights",    &pathfinding.avoid_traffic_lights     , 0.1f, 0, 2);
+			ImGui::Checkbox("astar", &pathfinding.astar);
+			ImGui::Checkbox("radix_heap", &pathfinding.radix_heap);
+			ImGui::Checkbox("async", &pathfinding.async);
+			ImGui::DragInt("frame_budget_iter", &pathfinding.frame_budget_iter, 10, 0, 1000000);
+			ImGui::DragInt("frame_budget_us", &pathfinding.frame_budget_us, 10, 0, 100000);
+			ImGui::Checkbox("contraction_hierarchy", &pathfinding.contraction_hierarchy);
+			ImGui::DragInt("path_cache_size", &pathfinding.path_cache_size, 16, 0, 1<<20);
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Mesoscopic LOD")) {
+			ImGui::Checkbox("enable", &meso.enable);
+			ImGui::DragFloat("dist", &meso.dist, 1, 0, 10000);
+			ImGui::DragFloat("hysteresis", &meso.hysteresis, 0.01f, 1, 2);
+			ImGui::SliderFloat("min_speed_fac", &meso.min_speed_fac, 0, 1);
 			ImGui::TreePop();
 		}
 
@@ -1,175 +1,174 @@
 #include "common.hpp"
 #include "network_sim.hpp"
-#include "app.hpp"
+#include "world.hpp"
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 namespace network {
 
 //// Pathfinding
 
-// Pathfinding ignores lanes other than checking if any lane allows the turn to a node being visited
+// Pathfinding ignores lanes other than checking if any lane allows a turn, which is precomputed in the TurnGraph
 // Note: lane selection happens later during car path follwing, a few segments into the future
-// TODO: rewrite this with segments as the primary item? Make sure to handle start==dest
-//  and support roads with median, ie no enter or exit buildings with left turn -> which might cause uturns so that segments get visited twice
-//  supporting this might require keeping entries for both directions of segments
-bool Path::pathfind (Network& net, PathEnd start, PathEnd dest, std::vector<Segment*>* result_path) {
+// Searches directed segments, so a path can use the same segment in both directions (uturn around the block
+//  when a median prevents turning left into the destination) and start == dest results in a loop
+void PathfindQuery::begin (Network& net, PathfindContext& ctx, Path::PathEnd start, Path::PathEnd dest, bool astar) {
 	ZoneScoped;
-	// use dijkstra algorithm
-
-	struct Queued {
-		Node* node;
-		float cost;
-	};
-
-	struct Comparer {
-		bool operator () (Queued const& l, Queued const& r) {
-			// true: l < r
-			// but since priority_queue only lets us get
-			// max element rather than min flip everything around
-			return l.cost > r.cost;
-		}
-	};
-	std::priority_queue<Queued, std::vector<Queued>, Comparer> unvisited;
-
-	// prepare all nodes
-	for (auto& node : net.nodes) {
-		node->_cost = INF;
-		node->_visited = false;
-		node->_q_idx = -1;
-		node->_pred = nullptr;
-		node->_pred_seg = nullptr;
-	}
-
-	// FAILSAFE, TODO: fix!
-	// Currently if start == dest and forw,backw == true
-	//  either pathinding glitches and returns uturn (due to both start nodes being the dest nodes)
-	//  or (with _pred_seg != dest) check, both nodes fail, so rather than fail pathing, just arbitrarily restrict direction
-	if (start.seg == dest.seg && start.forw && start.backw)
-		start.backw = false;
-	
-	// handle the two start nodes
+	// use dijkstra algorithm, or A* if enabled
+
+	this->net = &net;
+	this->ctx = &ctx;
+	this->dest = dest;
+	graph_version = net._graph_version;
+	finished = false;
+	end_vertex = -1;
+	queue_size = 0;
+
+	// prepare all vertices (lazily, states from previous queries are invalidated by generation counter)
+	ctx.begin_query(net.graph.num_vertices());
+	
+	// A* heuristic: straight line distance to nearest dest node at max speed limit of network
+	// admissible (and consistent) since segment cost is (length + node radii) / speed_limit,
+	//  which is never less than distance between node centers / _max_speed_limit
+	this->astar = astar && net._max_speed_limit > 0;
+	inv_max_speed = this->astar ? 1.0f / net._max_speed_limit : 0;
+
+	dest_forw  = TurnGraph::vertex(dest.seg, LaneDir::FORWARD);
+	dest_backw = TurnGraph::vertex(dest.seg, LaneDir::BACKWARD);
+	
+	ctx._iter = 0;
+	ctx._decreases = 0;
+	ctx._max_queue = 0;
+	ctx._iter_edges = 0;
+	ctx._algorithm = this->astar ? "A*" : "dijkstra";
+
+	// indexed heaps, vertices are queued at most once and their key is decreased in place
+	// radix heap uses quantized keys, which is valid since keys are popped in monotone order (dijkstra or A* with consistent heuristic)
+	use_radix = net.settings.pathfinding.radix_heap;
+
+	ctx.heap.clear();
+	for (auto& b : ctx.radix_buckets) b.clear();
+	ctx.radix_last = 0;
+	
+	// handle the two start directions
 	// pretend start point is at center of start segment for now
 	// forw/backw can restrict the direction allowed for the start segment
+	// start vertices themselves are never queued, but relaxed directly, so that they can be reached again when start == dest
 	
 	// Assume start and dest points are in middle of segment, this is wrong!
 	// but we might not even know the correct dest segment t, due to parking being chosen when vehicle is close to destination
 	// and this should not make a huge difference (only difference is final forw/backw approach, which we can already restrict if needed!)
 
-	if (start.forw) {
-		start.seg->node_b->_cost = (start.seg->_length * 0.5f) / start.seg->asset->speed_limit;
-		start.seg->node_b->_pred_seg = start.seg;
-		unvisited.push({ start.seg->node_b, start.seg->node_b->_cost });
-	}
-	if (start.backw) {
-		start.seg->node_a->_cost = (start.seg->_length * 0.5f) / start.seg->asset->speed_limit;
-		start.seg->node_a->_pred_seg = start.seg;
-		unvisited.push({ start.seg->node_a, start.seg->node_a->_cost });
-	}
-	
-	net.pathing_count++;
+	float start_cost = (start.seg->_length * 0.5f) / start.seg->asset->speed_limit;
+	if (start.forw)  relax_edges(TurnGraph::vertex(start.seg, LaneDir::FORWARD ), start_cost, true);
+	if (start.backw) relax_edges(TurnGraph::vertex(start.seg, LaneDir::BACKWARD), start_cost, true);
+}
 
-	net._dijk_iter = 0;
-	net._dijk_iter_dupl = 0;
-	net._dijk_iter_lanes = 0;
-	
-	while (!unvisited.empty()) {
-		net._dijk_iter_dupl++;
-		
-		// visit node with min cost
-		auto _cur_node = unvisited.top();
-		Node* cur_node = _cur_node.node;
-		unvisited.pop();
+float PathfindQuery::heuristic (int vertex) {
+	if (!astar) return 0.0f;
+	float3 pos = net->graph.vertex_pos[vertex];
+	float dist = min(distance(pos, dest.seg->node_a->pos), distance(pos, dest.seg->node_b->pos));
+	return dist * inv_max_speed;
+}
 
-		if (cur_node->_visited) continue;
-		cur_node->_visited = true;
+void PathfindQuery::relax_edges (int vertex, float cost, bool from_start) {
+	auto& graph = net->graph;
 
-		net._dijk_iter++;
+	for (int e=graph.edges_begin[vertex]; e<graph.edges_begin[vertex+1]; ++e) {
+		auto& edge = graph.edges[e];
 
-		// early out optimization
-		if (dest.seg->node_a->_visited && dest.seg->node_b->_visited)
-			break; // shortest path found if both dest segment nodes are visited
+		float new_cost = cost + edge.cost;
+		auto& other = (*ctx)[edge.target];
+		if (new_cost < other.cost && !other.visited) {
+			bool queued = other.q_idx >= 0;
+			if (queued) {
+				// radix heap finds item by its old key
+				if (use_radix) radix_heap().erase(edge.target);
+				ctx->_decreases++;
+			}
+			else {
+				queue_size++;
+				ctx->_max_queue = max(ctx->_max_queue, queue_size);
+			}
 
-		// Get all allowed turns for incoming segment
-		Turns allowed = Turns::NONE;
-		for (auto lane : cur_node->_pred_seg->in_lanes(cur_node)) {
-			allowed |= lane.get().allowed_turns;
+			other.pred       = vertex;
+			other.from_start = from_start;
+			other.cost       = new_cost;
+			other.key        = new_cost + heuristic(edge.target);
+
+			if (use_radix) {
+				// clamp since float error in heuristic could make key slightly less than last popped
+				other.qkey = max((uint32_t)(other.key * PathfindContext::RADIX_KEY_SCALE), ctx->radix_last);
+				radix_heap().push(edge.target);
+			}
+			else {
+				heap().push_or_decrease(edge.target);
+			}
 		}
 
-		float cur_cost = cur_node->_cost;
-		
-		{
-			float traffic_light_cost = cur_node->traffic_light ? cur_node->traffic_light->approx_wait_time() : 0;
-			cur_cost += traffic_light_cost * net.settings.pathfinding.avoid_traffic_lights;
-		}
-
-		// update neighbours with new minimum cost
-		for (auto& seg : cur_node->segments) {
-			for (auto lane : seg->in_lanes(cur_node)) { // This is dumb and makes no sense, TODO: fix it!
-				Node* other_node = seg->get_other_node(cur_node);
-
-				// check if turn to this node is actually allowed
-				auto turn = classify_turn(cur_node, cur_node->_pred_seg, lane.seg);
-				if (!any_set(allowed, turn)) {
-					// turn not allowed
-					//assert(false); // currently impossible, only the case for roads with no right turn etc.
-					continue;
-				}
+		ctx->_iter_edges++;
+	}
+}
 
-				float len = lane.seg->_length + lane.seg->node_a->_radius + lane.seg->node_b->_radius;
-				float cost = len / lane.seg->asset->speed_limit;
-				assert(cost > 0);
+bool PathfindQuery::step (int max_iter) {
+	ZoneScoped;
+	if (finished) return true;
 
-				float new_cost = cur_cost + cost;
-				if (new_cost < other_node->_cost && !other_node->_visited) {
-					other_node->_pred      = cur_node;
-					other_node->_pred_seg  = lane.seg;
-					other_node->_cost      = new_cost;
-					//assert(!other_node->_visited); // dijstra with positive costs should prevent this
+	auto heap = this->heap();
+	auto radix_heap = this->radix_heap();
+	
+	for (int i=0; i<max_iter; ++i) {
+		if (queue_size == 0) {
+			finished = true; // no path
+			break;
+		}
 
-					unvisited.push({ other_node, other_node->_cost }); // push updated neighbour (duplicate)
-				}
+		// visit vertex with min cost
+		int cur_vertex = use_radix ? radix_heap.pop() : heap.pop();
+		queue_size--;
 
-				net._dijk_iter_lanes++;
-			}
-		}
-	}
-	
-	//// make path out of dijkstra graph
-	
-	// additional distances from a and b of the dest segment
-	float dist_from_a = 0.5f;
-	float dist_from_b = 0.5f;
+		auto& cur = (*ctx)[cur_vertex];
+		assert(!cur.visited);
+		cur.visited = true;
 
-	Node* end_node = nullptr;
-	float a_cost = dest.seg->node_a->_cost + dist_from_a / dest.seg->asset->speed_limit;
-	float b_cost = dest.seg->node_b->_cost + dist_from_b / dest.seg->asset->speed_limit;
+		ctx->_iter++;
 
-	// do not count final node if coming from dest segment, to correctly handle start == dest
-	if (dest.seg->node_a->_pred_seg && dest.seg->node_a->_pred_seg != dest.seg) {
-		end_node = dest.seg->node_a;
-	}
-	if (dest.seg->node_b->_pred_seg && dest.seg->node_b->_pred_seg != dest.seg) {
-		// if both nodes count, choose end node that end up fastest
-		if (!end_node || b_cost < a_cost) {
-			end_node = dest.seg->node_b;
+		// with a consistent heuristic (or none) vertices are visited with their final cost,
+		//  so the first dest vertex visited is the shortest path
+		if (cur_vertex == dest_forw || cur_vertex == dest_backw) {
+			end_vertex = cur_vertex;
+			finished = true;
+			break;
 		}
+
+		relax_edges(cur_vertex, cur.cost, false);
 	}
+	return finished;
+}
+
+bool PathfindQuery::get_result (std::vector<Segment*>* result_path) {
+	assert(finished);
+	
+	//// make path out of dijkstra graph
 
-	if (!end_node)
+	if (end_vertex < 0)
 		return false; // no path found
-		
-	assert(end_node->_cost < INF);
 
 	std::vector<Segment*> reverse_segments;
-	reverse_segments.push_back(dest.seg);
 
-	Node* cur = end_node;
-	while (cur) {
-		assert(cur->_pred_seg);
-		reverse_segments.push_back(cur->_pred_seg);
-		cur = cur->_pred;
+	int cur = end_vertex;
+	for (;;) {
+		auto& v = (*ctx)[cur];
+		assert(v.pred >= 0);
+		reverse_segments.push_back(net->segments[TurnGraph::vertex_seg(cur)].get());
+
+		cur = v.pred;
+		if (v.from_start) break;
 	}
-	assert(reverse_segments.size() >= 2); // code currently can't handle single segment path
-	// TODO: make that possible and then handle make driving into building on other side of road possible? Or should we just have it drive around the block for this?
+	reverse_segments.push_back(net->segments[TurnGraph::vertex_seg(cur)].get());
+
+	assert(reverse_segments.size() >= 2);
 
 	for (int i=(int)reverse_segments.size()-1; i>=0; --i) {
 		result_path->push_back(reverse_segments[i]);
@@ -177,6 +176,144 @@ bool Path::pathfind (Network& net, PathEnd start, PathEnd dest, std::vector<Segm
 
 	return true;
 }
+
+bool pathfind_graph (Network& net, PathfindContext& ctx, Path::PathEnd start, Path::PathEnd dest,
+		std::vector<Segment*>* result_path, bool astar) {
+	PathfindQuery query;
+	query.begin(net, ctx, start, dest, astar);
+	query.step(INT_MAX);
+	return query.get_result(result_path);
+}
+// Query contraction hierarchy, which works on directed segments, so turn restrictions are respected exactly
+// start == dest is not supported, since the start segment itself would already be a valid path
+bool pathfind_ch (Network& net, ContractionHierarchy const& ch, PathfindContext& ctx, Path::PathEnd start, Path::PathEnd dest,
+		std::vector<Segment*>* result_path) {
+	assert(start.seg != dest.seg);
+
+	ContractionHierarchy::Endpoint sources[2], targets[2];
+	int num_sources = 0;
+
+	float start_cost = (start.seg->_length * 0.5f) / start.seg->asset->speed_limit;
+	if (start.forw)  sources[num_sources++] = { TurnGraph::vertex(start.seg, LaneDir::FORWARD ), start_cost };
+	if (start.backw) sources[num_sources++] = { TurnGraph::vertex(start.seg, LaneDir::BACKWARD), start_cost };
+	targets[0] = { TurnGraph::vertex(dest.seg, LaneDir::FORWARD ), 0 };
+	targets[1] = { TurnGraph::vertex(dest.seg, LaneDir::BACKWARD), 0 };
+
+	std::vector<int> vertices;
+	float cost;
+	bool found = ch.query(ctx.ch, sources, num_sources, targets, 2, &vertices, &cost);
+
+	ctx._algorithm = "CH";
+	ctx._iter = ctx.ch._iter;
+	ctx._decreases = 0;
+	ctx._max_queue = 0;
+	ctx._iter_edges = 0;
+
+	if (!found)
+		return false;
+
+	assert(vertices.size() >= 2);
+	for (int v : vertices) {
+		result_path->push_back(net.segments[TurnGraph::vertex_seg(v)].get());
+	}
+	return true;
+}
+
+bool Path::pathfind (Network& net, PathfindContext& ctx, PathEnd start, PathEnd dest, std::vector<Segment*>* result_path) {
+	auto& settings = net.settings.pathfinding;
+
+	if (settings.contraction_hierarchy && start.seg != dest.seg) {
+		// only use while up to date with network
+		auto* ch = net.ch.get_current();
+		if (ch)
+			return pathfind_ch(net, *ch, ctx, start, dest, result_path);
+	}
+
+	return pathfind_graph(net, ctx, start, dest, result_path, settings.astar);
+}
+
+// Compare contraction hierarchy paths against dijkstra on random origin/destination pairs
+// both search the same TurnGraph, so costs should always be equal (paths can differ for ties)
+void debug_contraction_hierarchy (Network& net) {
+	if (!imgui_Header("contraction_hierarchy")) return;
+
+	struct VerifyResult {
+		int pairs = 0;
+		int both_failed = 0;
+		int only_ch_failed = 0;
+		int only_dijk_failed = 0;
+		int equal = 0;
+		int ch_better = 0;
+		int ch_worse = 0;
+		float ch_time = 0;
+		float dijk_time = 0;
+	};
+	static VerifyResult res;
+	static int num_pairs = 1000;
+
+	auto* ch = net.ch.get_current();
+	if (ch) {
+		ImGui::Text("vertices: %d shortcuts: %d build time: %.1fms", ch->num_vertices(), ch->_shortcuts, ch->_build_time * 1000);
+	}
+	else {
+		ImGui::Text(net.ch.is_building() ? "building..." : "not built (enable in Pathfinding settings)");
+	}
+
+	ImGui::DragInt("verify_pairs", &num_pairs, 1, 1, 100000);
+	if (ImGui::Button("Verify against Dijkstra") && ch) {
+		ZoneScopedN("verify contraction_hierarchy");
+		res = {};
+
+		auto& graph = net.graph;
+
+		PathfindContext ctx;
+		Random rand(0);
+
+		for (int i=0; i<num_pairs; ++i) {
+			Path::PathEnd start = { net.segments[rand.uniformi(0, (int)net.segments.size())].get() };
+			Path::PathEnd dest  = { net.segments[rand.uniformi(0, (int)net.segments.size())].get() };
+			if (start.seg == dest.seg) continue;
+			res.pairs++;
+
+			std::vector<Segment*> ch_path, dijk_path;
+
+			auto t0 = std::chrono::steady_clock::now();
+			bool ch_found = pathfind_ch(net, *ch, ctx, start, dest, &ch_path);
+			auto t1 = std::chrono::steady_clock::now();
+			bool dijk_found = pathfind_graph(net, ctx, start, dest, &dijk_path, false);
+			auto t2 = std::chrono::steady_clock::now();
+
+			res.ch_time   += std::chrono::duration<float>(t1 - t0).count();
+			res.dijk_time += std::chrono::duration<float>(t2 - t1).count();
+
+			if (!ch_found || !dijk_found) {
+				if      (!ch_found && !dijk_found) res.both_failed++;
+				else if (!ch_found)                res.only_ch_failed++;
+				else                               res.only_dijk_failed++;
+				continue;
+			}
+
+			float start_cost = (start.seg->_length * 0.5f) / start.seg->asset->speed_limit;
+			float ch_cost   = graph.path_cost(start_cost, ch_path);
+			float dijk_cost = graph.path_cost(start_cost, dijk_path);
+			assert(ch_cost < INF && dijk_cost < INF);
+
+			if      (abs(ch_cost - dijk_cost) <= dijk_cost * 0.0001f)  res.equal++;
+			else if (ch_cost < dijk_cost)                              res.ch_better++;
+			else                                                       res.ch_worse++;
+		}
+	}
+
+	if (res.pairs > 0) {
+		ImGui::Text("pairs: %d equal: %d ch_better: %d ch_worse: %d", res.pairs, res.equal, res.ch_better, res.ch_worse);
+		ImGui::Text("failed: both: %d only_ch: %d only_dijk: %d",
+			res.both_failed, res.only_ch_failed, res.only_dijk_failed);
+		ImGui::Text("avg query: ch: %.3fms dijkstra: %.3fms",
+			res.ch_time * 1000 / res.pairs, res.dijk_time * 1000 / res.pairs);
+	}
+
+	ImGui::PopID();
+}
 void debug_last_pathfind (Network& net, View3D& view) {
 	
 	static bool visualize = false;
@@ -187,30 +324,224 @@ void debug_last_pathfind (Network& net, View3D& view) {
 	
 	if (!visualize) return;
 	
+	auto& ctx = net.pathfind_ctx;
+
 	float max_cost = 0;
-	for (auto& node : net.nodes) {
-		if (node->_visited) {
-			max_cost = max(max_cost, node->_cost);
+	for (int v=0; v<(int)ctx.vertices.size(); ++v) {
+		auto* state = ctx.try_get(v);
+		if (state && state->visited) {
+			max_cost = max(max_cost, state->cost);
 		}
 	}
 
-	for (auto& node : net.nodes) {
-		if (node->_visited) {
-			float cost_a = node->_cost / max_cost;
+	// visited directed segments as arrows towards the node they lead to
+	for (int v=0; v<(int)ctx.vertices.size() && v < net.graph.num_vertices(); ++v) {
+		auto* state = ctx.try_get(v);
+		if (state && state->visited) {
+			float cost_a = state->cost / max_cost;
 			lrgba col = lerp(lrgba(1,0,1,1), lrgba(1,0,0,1), clamp(cost_a, 0.0f, 1.0f));
 
-			g_dbgdraw.wire_circle(node->pos, node->_radius, col);
+			Segment* seg = net.segments[TurnGraph::vertex_seg(v)].get();
+			Node* node = seg->get_node_in_dir(TurnGraph::vertex_dir(v));
+			float3 pos = (seg->pos_a + seg->pos_b) * 0.5f;
+
+			g_dbgdraw.arrow(view, pos, node->pos - pos, 5, col);
+
+			g_dbgdraw.text.draw_text(prints("%.0f", state->cost), 30,
+				1, g_dbgdraw.text.map_text(lerp(pos, node->pos, 0.5f), view));
+		}
+	}
+}
+
+void PathfindQueue::Job::execute () {
+	ZoneScoped;
+	// one context per thread, reused for all jobs
+	thread_local PathfindContext ctx;
+
+	std::vector<Segment*> segments;
+	success = Path::pathfind(*net, ctx, start, dest, &segments);
+	if (success)
+		path = PathSegments(std::move(segments));
+	iter = ctx._iter;
+
+	finish_time = std::chrono::steady_clock::now();
+}
+
+void PathfindQueue::request (Network& net, Person& person, Building* dest_building, Path::PathEnd start, Path::PathEnd dest) {
+	auto job = std::make_unique<Job>();
+	job->net = &net;
+	job->person = &person;
+	job->dest_building = dest_building;
+	job->start = start;
+	job->dest = dest;
+
+	if (net.settings.pathfinding.path_cache_size > 0) {
+		job->path = net.path_cache.find(start, dest);
+		job->cached = !job->path.empty();
+		job->success = job->cached;
+	}
+
+	requests.push_back(std::move(job));
+
+	person.trip_requested = true;
+	net.pathing_count++;
+}
+void PathfindQueue::dispatch (bool async, bool sliced) {
+	ZoneScoped;
+	// sliced results can still wait in dispatched for the next tick, they are only added to pending here
+	assert(in_flight == 0 && (sliced || dispatched.empty()));
+
+	if (requests.empty()) return;
+
+	auto now = std::chrono::steady_clock::now();
+	for (int i=0; i<(int)requests.size(); ++i) {
+		requests[i]->order = i;
+		requests[i]->dispatch_time = now;
+		requests[i]->cache_epoch = requests[i]->net->path_cache.epoch;
+	}
 
-			g_dbgdraw.text.draw_text(prints("%.0f", node->_cost), 30,
-				1, g_dbgdraw.text.map_text(node->pos, view));
+	// cache hits are already solved, only dispatch the rest
+	for (auto& job : requests) {
+		if (job->cached) job->finish_time = now;
+	}
 
-			if (node->_pred_seg) {
-				float3 pos = (node->_pred_seg->pos_a + node->_pred_seg->pos_b) * 0.5f;
+	if (async) {
+		if (!threadpool) {
+			int num_threads = max((int)std::thread::hardware_concurrency()-2, 2);
+			threadpool = std::make_unique<Threadpool<Job>>(num_threads, TPRIO_BACKGROUND, "pathfind threads");
+		}
+
+		Jobs to_solve;
+		for (auto& job : requests) {
+			if (job->cached) dispatched.push_back(std::move(job));
+			else             to_solve.push_back(std::move(job));
+		}
 
-				g_dbgdraw.arrow(view, pos, node->pos - pos, 5, lrgba(0,1,1,1));
+		in_flight = (int)to_solve.size();
+		if (in_flight > 0)
+			threadpool->jobs.push_n(to_solve.data(), to_solve.size());
+	}
+	else if (sliced) {
+		// cache hits go through pending as well to keep request order
+		for (auto& job : requests)
+			pending.push_back(std::move(job));
+	}
+	else {
+		for (auto& job : requests) {
+			if (!job->cached) job->execute();
+		}
+		dispatched = std::move(requests);
+	}
+	requests.clear();
+}
+void PathfindQueue::update_sliced (Network& net) {
+	_last_sliced_iter = 0;
+	_last_sliced_time = 0;
+	if (pending.empty()) return;
+	ZoneScoped;
+
+	auto& settings = net.settings.pathfinding;
+	auto start_time = std::chrono::steady_clock::now();
+
+	int iter_left = settings.frame_budget_iter > 0 ? settings.frame_budget_iter : INT_MAX;
+	float time_budget = settings.frame_budget_us > 0 ? (float)settings.frame_budget_us * 0.000001f : INF;
+
+	float elapsed = 0;
+	while (!pending.empty() && iter_left > 0 && elapsed < time_budget) {
+		auto& job = pending.front();
+
+		if (!job->cached) {
+			// (re)start query, vertex states are invalid if graph was rebuilt while suspended
+			if (!job->started || query.graph_version != net._graph_version) {
+				query.begin(net, sliced_ctx, job->start, job->dest, settings.astar);
+				job->started = true;
 			}
+
+			int iter_before = sliced_ctx._iter;
+			bool done = query.step(min(iter_left, SLICE_ITER));
+
+			int iter = sliced_ctx._iter - iter_before;
+			iter_left -= iter;
+			_last_sliced_iter += iter;
+
+			if (done) {
+				std::vector<Segment*> segments;
+				job->success = query.get_result(&segments);
+				if (job->success)
+					job->path = PathSegments(std::move(segments));
+				job->iter = sliced_ctx._iter;
+			}
+
+			elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start_time).count();
+			if (!done) continue; // budget checked by loop
 		}
+
+		job->finish_time = std::chrono::steady_clock::now();
+		dispatched.push_back(std::move(job));
+		pending.pop_front();
 	}
+
+	_last_sliced_time = elapsed;
+}
+void PathfindQueue::wait () {
+	if (in_flight == 0) return;
+	ZoneScoped;
+
+	for (; in_flight > 0; --in_flight) {
+		dispatched.push_back(threadpool->results.pop_wait());
+	}
+	// results arrive in order of completion, restore request order
+	std::sort(dispatched.begin(), dispatched.end(), [] (std::unique_ptr<Job> const& l, std::unique_ptr<Job> const& r) {
+		return l->order < r->order;
+	});
+}
+void PathfindQueue::apply_results (World& app, Network& net) {
+	ZoneScoped;
+	wait();
+
+	_last_count += (int)dispatched.size();
+
+	for (auto& job : dispatched) {
+		_last_latency = max(_last_latency, std::chrono::duration<float>(job->finish_time - job->dispatch_time).count());
+		_last_total_iter += job->iter;
+
+		auto& person = *job->person;
+		assert(person.trip_requested && person.cur_building && !person.trip);
+		person.trip_requested = false;
+
+		if (!job->success) {
+			person.stay_timer = 1;
+			net.person_scheduler.schedule(person, person.stay_timer);
+			continue;
+		}
+
+		// network changed while solving, path is still fine for this trip but might go through invalidated nodes
+		if (!job->cached && job->cache_epoch == net.path_cache.epoch)
+			net.path_cache.insert(job->start, job->dest, job->path, net.settings.pathfinding.path_cache_size);
+
+		PersonTrip::begin_trip(person, net, job->dest_building, job->path);
+		
+		PersonTrip::update_vehicle(app, person, net, 0); // 0 dt timestep to init some values properly
+	}
+
+	dispatched.clear();
+}
+void PathfindQueue::clear () {
+	wait();
+
+	// persons might survive clear, don't leave them waiting forever
+	auto retry_later = [] (std::unique_ptr<Job>& job) {
+		job->person->trip_requested = false;
+		job->person->stay_timer = 1;
+		job->net->person_scheduler.schedule(*job->person, job->person->stay_timer);
+	};
+	for (auto& job : requests)   retry_later(job);
+	for (auto& job : dispatched) retry_later(job);
+	for (auto& job : pending)    retry_later(job);
+
+	requests.clear();
+	dispatched.clear();
+	pending.clear();
 }
 
 //// Path following
@@ -434,17 +765,6 @@ float get_curve_speed_limit (Bezier3 const& bez, SegLane cur_lane, SegLane next_
 }
 
 
-std::optional<Path> Path::begin (Network& net, Endpoint start, Endpoint dest) {
-	Path p;
-	p.start = start;
-	p.dest = dest;
-	
-	PathEnd path_start = {start.building->connected_segment};
-	PathEnd path_dest  = {dest.building->connected_segment};
-	if (pathfind(net, path_start, path_dest, &p.path))
-		return p;
-	return std::nullopt;
-}
 bool Path::repath (Network& net, Endpoint new_dest, Vehicle& veh) {
 	auto& mot = veh.sim->mot;
 	if (mot.motion == END)
@@ -515,11 +835,12 @@ bool Path::repath (Network& net, Endpoint new_dest, Vehicle& veh) {
 		}
 	}
 
-	if (!pathfind(net, path_start, path_dest, &new_path))
+	net.pathing_count++;
+	if (!pathfind(net, net.pathfind_ctx, path_start, path_dest, &new_path))
 		return false; // fail, leave things unchanged!
 
 	// replace path and mot
-	path = new_path;
+	path = PathSegments(std::move(new_path));
 	mot = get_motion(net, new_idx, &dummy_mot, veh, false);
 	return true;
 }
@@ -534,10 +855,9 @@ Path::Motion Path::get_motion (Network& net, int idx, Motion* prev, Vehicle& veh
 	int num_moves = num_seg + (num_seg-1) + 2;
 	assert(num_seg >= 1);
 
-	// Make lane selection deterministic for path visualization
+	// Make lane selection deterministic for path visualization and reproducible across runs
 	// TODO: this requirement might go away once I do lane selections more robustly
-	//   Might still want to keep determinism based on car id + path progress int, just so reloading a save mot results in the same behavior?
-	auto seeded_rand = Random(hash(idx, (uint64_t)this));
+	auto seeded_rand = Random(hash(idx, seed));
 	
 	if (idx == 0) {
 		s.motion = MotionType::START;
@@ -591,8 +911,7 @@ Path::Motion Path::get_motion (Network& net, int idx, Motion* prev, Vehicle& veh
 			// TODO: can this be written more concisely?
 			if (s.next_lane) {
 				Node* cur_node = Node::between(s.cur_lane.seg, s.next_lane.seg);
-				auto curve_bez = cur_node->calc_curve(s.cur_lane, s.next_lane);
-				s.next_speedlim = get_curve_speed_limit(curve_bez, s.cur_lane, s.next_lane);
+				s.next_speedlim = cur_node->get_conn(s.cur_lane, s.next_lane).speed_limit;
 			}
 			else {
 				s.next_speedlim = get_speed_limit(MotionType::END);
@@ -611,9 +930,10 @@ Path::Motion Path::get_motion (Network& net, int idx, Motion* prev, Vehicle& veh
 			
 			//s.cur_vehicles  = nullptr;
 			
-			s.bezier = cur_node->calc_curve(s.cur_lane, s.next_lane);
+			auto conn = cur_node->get_conn(s.cur_lane, s.next_lane);
+			s.bezier = conn.bezier;
 
-			s.cur_speedlim  = get_curve_speed_limit(s.bezier, s.cur_lane, s.next_lane);
+			s.cur_speedlim  = conn.speed_limit;
 			s.next_speedlim = get_speed_limit(MotionType::SEGMENT, s.next_lane);
 		}
 	}
@@ -625,7 +945,7 @@ void Path::visualize (OverlayDraw& overlay, Network& net, Vehicle& veh, bool ski
 	if (path.empty() || veh.sim->mot.motion == SHUTDOWN) return;
 
 	Motion mot = veh.sim->mot; // copy motion
-	float start_t = veh.sim->mot.motion == STARTUP ? 0 : veh.sim->mot_t;
+	float start_t = veh.sim->mot.motion == STARTUP ? 0 : veh.sim->mot_t();
 	
 	// corretly handle first motion
 	while (!(mot.motion == END && start_t >= mot.end_t)) {
@@ -652,10 +972,10 @@ float _brake_for_dist (float obstacle_dist) {
 }
 void brake_for_dist (Vehicle& veh, float obstacle_dist) {
 	float brake = _brake_for_dist(obstacle_dist);
-	veh.sim->brake = min(veh.sim->brake, brake);
+	veh.sim->brake() = min(veh.sim->brake(), brake);
 }
 
-auto dbg_lane_alloc (App& app, SegLane const& lane, Vehicle const& veh) {
+auto dbg_lane_alloc (World& app, SegLane const& lane, Vehicle const& veh) {
 	auto bez = lane._bezier();
 	float t1 = lane.vehicles().avail_space / lane.seg->_length;
 
@@ -670,32 +990,32 @@ bool lane_alloc_can_alloc (SegLane const& lane, Vehicle const& veh) {
 	float avail_space = lane.vehicles().avail_space;
 	return avail_space >= veh.asset->length();
 }
-void lane_alloc_reserve (App& app, SegLane& lane, Vehicle const& veh, bool dbg=false) {
+void lane_alloc_reserve (World& app, SegLane& lane, Vehicle const& veh, bool dbg=false) {
 	if (dbg) dbg_lane_alloc(app, lane, veh);
 	lane.vehicles().avail_space -= veh.asset->length() + SAFETY_DIST*1.25f;
 }
-void segment_lane_alloc (App& app, SegLane& lane, bool dbg=false) {
-	
-	auto& avail_space = lane.vehicles().avail_space;
-
-	{ // find vehicle in node but still touching lane
-		float space_taken = 0;
+// space at the end of lane taken by vehicles in node but still touching lane
+float lane_end_space_taken (SegLane const& lane) {
+	float space_taken = 0;
 
-		auto* other_node = Segment::node_from_lane(lane);
-		for (auto& v : other_node->vehicles.test.list) {
-			if (v.veh->sim->mot.motion == Path::NODE && v.conn.conn.a == lane) {
-				space_taken = max(space_taken, -v.rear_k);
-			}
+	auto* other_node = Segment::node_from_lane(lane);
+	for (auto& v : other_node->vehicles.test.list) {
+		if (v.veh->sim->mot.motion == Path::NODE && v.conn.conn.a == lane) {
+			space_taken = max(space_taken, -v.rear_k);
 		}
-
-		avail_space = lane.seg->_length - (space_taken + SAFETY_DIST*1.25f);
 	}
+	return space_taken;
+}
+void segment_lane_alloc (World& app, SegLane& lane, bool dbg=false) {
+	
+	auto& avail_space = lane.vehicles().avail_space;
+	avail_space = lane.seg->_length - (lane_end_space_taken(lane) + SAFETY_DIST*1.25f);
 
-	for (auto* a : lane.vehicles().list.list) {
+	for (auto* a : lane.vehicles()) {
 		lane_alloc_reserve(app, lane, *a, dbg);
 	}
 }
-void dbg_node_lane_alloc (App& app, Node* node) {
+void dbg_node_lane_alloc (World& app, Node* node) {
 	
 	for (auto* seg : node->segments) {
 		for (auto out_lane : seg->out_lanes(node)) {
@@ -717,7 +1037,7 @@ void dbg_node_lane_alloc (App& app, Node* node) {
 }
 
 //// Visualization
-void overlay_lane_vehicle (App& app, Vehicle& veh, lrgba col, int tex) {
+void overlay_lane_vehicle (World& app, Vehicle& veh, lrgba col, int tex) {
 	if (!veh.sim->mot.valid())
 		return;
 
@@ -727,8 +1047,8 @@ void overlay_lane_vehicle (App& app, Vehicle& veh, lrgba col, int tex) {
 	// sample bezier with t to determine worldspace pos, or draw bezier with overlay etc.
 	
 	Bezier3 cur_bez = veh.sim->mot.bezier;
-	float t1 = veh.sim->mot_t;
-	float t0 = veh.sim->mot_t - veh.asset->length() / veh.sim->bez_speed; // t - len / (dlen / dt) => t - dt
+	float t1 = veh.sim->mot_t();
+	float t0 = veh.sim->mot_t() - veh.asset->length() / veh.sim->bez_speed(); // t - len / (dlen / dt) => t - dt
 	if (t0 < 0) {
 		// car rear on different bezier!
 		t0 = 0;
@@ -738,16 +1058,16 @@ void overlay_lane_vehicle (App& app, Vehicle& veh, lrgba col, int tex) {
 	
 	app.overlay.curves.push_bezier(cur_bez, float2(LANE_COLLISION_R*2, 1), tex, col, float2(t0,t1));
 }
-bool dbg_conflicts (App& app, Node* node, Vehicle& veh);
+bool dbg_conflicts (World& app, Node* node, Vehicle& veh);
 
-void debug_segment (App& app, Segment* seg) {
+void debug_segment (World& app, Segment* seg) {
 	if (!seg) return;
 	
 	for (auto& spot : seg->parking.spots) {
 		spot.dbg_draw();
 	}
 }
-void debug_node (App& app, Node* node, View3D const& view) {
+void debug_node (World& app, Node* node, View3D const& view) {
 	if (!node) return;
 	
 	static bool debug_priority_order = false;
@@ -760,7 +1080,7 @@ void debug_node (App& app, Node* node, View3D const& view) {
 		ImGui::Checkbox("show_lane_connections", &show_lane_connections);
 		ImGui::Checkbox("debug_vehicle_lists", &debug_vehicle_lists);
 
-		ImGui::Text("%d conflicts cached", (int)node->vehicles.conflict_cache.size());
+		ImGui::Text("%d connections %d conflicts", (int)node->_conns.size(), (int)node->_conflicts.size());
 
 		ImGui::PopID();
 	}
@@ -788,7 +1108,7 @@ void debug_node (App& app, Node* node, View3D const& view) {
 			col.w = 0.5f;
 			for (auto lane_in : seg->in_lanes(node)) {
 				for (auto lane_out : lane_in.get().connections) {
-					auto bez = node->calc_curve(lane_in, lane_out);
+					auto bez = node->get_conn(lane_in, lane_out).bezier;
 					app.overlay.curves.push_arrow(bez, float2(3.5f, 1), OverlayDraw::TEXTURE_THIN_ARROW, col);
 				}
 			}
@@ -809,7 +1129,7 @@ void debug_node (App& app, Node* node, View3D const& view) {
 		for (auto* seg : node->segments) {
 			for (auto lane : seg->in_lanes(node)) {
 				if (ImGui::TreeNodeEx("In  LaneVehicles", ImGuiTreeNodeFlags_DefaultOpen)) {
-					for (auto* v : lane.vehicles().list.list) {
+					for (auto* v : lane.vehicles()) {
 						show_vehicle(*v);
 					}
 					ImGui::TreePop();
@@ -818,7 +1138,7 @@ void debug_node (App& app, Node* node, View3D const& view) {
 		
 			for (auto lane : seg->out_lanes(node)) {
 				if (ImGui::TreeNodeEx("Out LaneVehicles", ImGuiTreeNodeFlags_DefaultOpen)) {
-					for (auto* v : lane.vehicles().list.list) {
+					for (auto* v : lane.vehicles()) {
 						show_vehicle(*v);
 					}
 					ImGui::TreePop();
@@ -855,15 +1175,16 @@ void debug_node (App& app, Node* node, View3D const& view) {
 	}
 #endif
 }
-void debug_vehicle (App& app, Vehicle& veh, View3D const& view) {
+void debug_vehicle (World& app, Vehicle& veh, View3D const& view) {
 	assert(veh.sim);
+	if (!veh.sim->states) return; // debug vehicles are not simulated
 
 	static bool visualize_lane_section = false;
 	static bool visualize_nav = true;
 	static bool visualize_conflicts = true;
 	static bool visualize_bones = false;
 	static ValuePlotter speed_plot = ValuePlotter();
-	speed_plot.push_value(veh.sim->speed);
+	speed_plot.push_value(veh.sim->speed());
 
 	if (imgui_Header("debug_person", true)) {
 		ImGui::Checkbox("visualize_lane_section", &visualize_lane_section);
@@ -875,7 +1196,7 @@ void debug_vehicle (App& app, Vehicle& veh, View3D const& view) {
 		ImGui::TextColored(lrgba(veh.tint_col, 1), "debug person");
 	
 		ImGui::Text("Speed Limit: %7s", app.options.format_speed(veh.sim->mot.cur_speedlim).c_str());
-		ImGui::Text("Speed: %7s",       app.options.format_speed(veh.sim->speed).c_str());
+		ImGui::Text("Speed: %7s",       app.options.format_speed(veh.sim->speed()).c_str());
 
 		speed_plot.imgui_display("speed", 0.0f, 100/KPH_PER_MS);
 
@@ -910,7 +1231,7 @@ void debug_vehicle (App& app, Vehicle& veh, View3D const& view) {
 		}
 	}
 }
-void debug_building (App& app, Building* build, View3D const& view) {
+void debug_building (World& app, Building* build, View3D const& view) {
 	if (!build) return;
 	
 	static bool debug_incoming_trips = true;
@@ -935,7 +1256,7 @@ void debug_building (App& app, Building* build, View3D const& view) {
 }
 
 #if 0
-void dbg_brake_for (App& app, Vehicle& veh, float dist, float3 obstacle, lrgba col) {
+void dbg_brake_for (World& app, Vehicle& veh, float dist, float3 obstacle, lrgba col) {
 	// dir does not actually point where we are going to stop
 	// obsticle visualizes what object we are stopping for
 	// dist is approx distance along bezier to stop at, which we don't bother visualizing exactly
@@ -951,21 +1272,21 @@ void dbg_brake_for (App& app, Vehicle& veh, float dist, float3 obstacle, lrgba c
 	g_dbgdraw.line(end - normal, end + normal, col);
 }
 #else
-void dbg_brake_for (App& app, Vehicle& veh, float dist, float3 obstacle, lrgba col) {}
+void dbg_brake_for (World& app, Vehicle& veh, float dist, float3 obstacle, lrgba col) {}
 #endif
-void _FORCEINLINE dbg_brake_for_vehicle (App& app, Vehicle& veh, float dist, Vehicle& obstacle) {
+void _FORCEINLINE dbg_brake_for_vehicle (World& app, Vehicle& veh, float dist, Vehicle& obstacle) {
 	if (app.interact.selection.get<Vehicle*>() == &veh) {
 		float3 center = (obstacle.sim->rear_pos + obstacle.sim->front_pos) * 0.5f;
 		dbg_brake_for(app, veh, dist, center, lrgba(1,0.1f,0,1));
 	}
 }
-void _FORCEINLINE dbg_brake_for_blocked_lane (App& app, Vehicle& veh, float dist, float3 obstacle) {
+void _FORCEINLINE dbg_brake_for_blocked_lane (World& app, Vehicle& veh, float dist, float3 obstacle) {
 	if (app.interact.selection.get<Vehicle*>() == &veh) {
 		dbg_brake_for(app, veh, dist, obstacle, lrgba(0.2f,0.8f,1,1));
 	}
 }
 
-void Network::draw_debug (App& app, View3D& view) {
+void Network::draw_debug (World& app, View3D& view) {
 	ZoneScoped;
 
 	debug_segment(app, app.interact.selection.get<Segment*>());
@@ -978,23 +1299,132 @@ void Network::draw_debug (App& app, View3D& view) {
 	}
 
 	debug_last_pathfind(app.network, view);
+	debug_contraction_hierarchy(app.network);
 
 	debug_building(app, app.interact.selection.get<Building*>(), view);
 }
 
 //// Segment logic
-void update_segment (App& app, Segment* seg) {
+// lane speed of mesoscopic vehicles, speed limit reduced by lane occupancy of the last segment pass
+float meso_lane_speed (Vehicle& veh) {
+	float speed_limit = max(veh.sim->mot.cur_speedlim * veh.aggressiveness_topspeed_accel_mul(), 1.0f);
+	return max(speed_limit * veh.sim->mot.cur_vehicles->meso_speed_fac, 1.0f);
+}
+// mot_t of vehicle in lane, estimated for queued mesoscopic vehicles
+float lane_vehicle_t (Network& net, Vehicle& veh) {
+	return veh.sim->meso_queued ? veh.sim->meso_est_t(net._sim_time) : veh.sim->mot_t();
+}
+
+// queue mesoscopic vehicle in its lane, it leaves the queue after driving the rest of the lane at lane speed
+// but not before its leader left plus the time to drive its own length, so queued vehicles leave spaced out
+void meso_enqueue (Network& net, Vehicle& veh) {
+	auto* sim = veh.sim.get();
+	float speed = meso_lane_speed(veh);
+	float remain_dist = max(sim->mot.end_t - sim->mot_t(), 0.0f) * sim->bez_speed();
+
+	double exit_time = net._sim_time + remain_dist / speed;
+	auto* leader = sim->lane_prev;
+	if (leader && leader->sim->meso_queued)
+		exit_time = std::max(exit_time, leader->sim->meso_exit_time + (veh.asset->length() + SAFETY_DIST) / speed);
+
+	sim->meso_queued = true;
+	sim->meso_enter_t = sim->mot_t();
+	sim->meso_enter_time = net._sim_time;
+	sim->meso_exit_time = exit_time;
+	sim->sleeping = false;
+
+	// not moved while queued, drop this tick's move so rendering doesn't keep interpolating it
+	sim->anim_step = {};
+	sim->prev_front_pos = sim->front_pos;
+	sim->prev_rear_pos  = sim->rear_pos;
+}
+// place vehicle leaving the queue at t in its lane
+void meso_dequeue (Vehicle& veh, float t) {
+	auto* sim = veh.sim.get();
+	auto bez_res = sim->mot.bezier.eval(t);
+	sim->mot_t() = t;
+	sim->bez_speed() = max(length(bez_res.vel), 1.0f);
+	sim->init_pos(PosRot{ bez_res.pos, angle2d((float2)bez_res.vel) }, veh.asset);
+
+	sim->meso_queued = false;
+}
+
+// promote queued vehicle to full simulation, placing it at its estimated position, but behind its leader
+// returns false if there is no room between leader and follower yet, vehicle stays queued and is tried again next tick
+bool meso_promote (Network& net, Vehicle& veh) {
+	auto* sim = veh.sim.get();
+	float t = sim->meso_est_t(net._sim_time);
+	float speed = meso_lane_speed(veh);
+
+	// leader was already promoted and placed, since lane is iterated from front
+	auto* leader = sim->lane_prev;
+	if (leader) {
+		float max_t = lane_vehicle_t(net, *leader) - (leader->asset->length() + SAFETY_DIST) / sim->bez_speed();
+		if (max_t < 0.0f)
+			return false;
+		t = min(t, max_t);
+		if (!leader->sim->meso_queued)
+			speed = min(speed, leader->sim->speed());
+	}
+	// full vehicles behind braked for the estimated position, but might be too close if moved back behind leader
+	auto* follower = sim->lane_next;
+	if (follower && !follower->sim->meso_queued) {
+		float min_t = follower->sim->mot_t() + (veh.asset->length() + SAFETY_DIST) / follower->sim->bez_speed();
+		if (t < min_t)
+			return false;
+	}
+
+	meso_dequeue(veh, t);
+	sim->speed() = speed;
+	return true;
+}
+
+// switch vehicles in lane between full and mesoscopic simulation by distance to lod_focus,
+// let the front vehicle leave the lane queue once its exit time passed
+// and update the lane speed for mesoscopic vehicles from occupancy
+void update_lane_lod (Network& net, SegLane lane) {
+	auto& lod = net.settings.meso;
+	auto& vehicles = lane.vehicles();
+
+	float occupied = 0;
+	for (auto* v : vehicles) {
+		occupied += v->asset->length() + SAFETY_DIST;
+
+		// queued vehicles were not moved, so use where they were queued
+		float dist = distance(v->sim->front_pos, net.lod_focus);
+		bool meso = lod.enable && dist > lod.dist * (v->sim->meso ? 1.0f : lod.hysteresis);
+
+		if (v->sim->meso_queued && !meso && !meso_promote(net, *v))
+			meso = true; // no room yet, stay queued
+		v->sim->meso = meso;
+	}
+
+	auto* front = vehicles.front();
+	if (front && front->sim->meso_queued && net._sim_time >= front->sim->meso_exit_time) {
+		auto* sim = front->sim.get();
+		// reached end of lane, but stay behind vehicles in the node still touching the lane
+		// then stepped again (and tracked by the node) to cross the node
+		float end_dist = lane_end_space_taken(lane) + 1.0f;
+		meso_dequeue(*front, max(sim->mot_t(), sim->mot.end_t - end_dist / sim->bez_speed()));
+	}
+
+	vehicles.meso_speed_fac = max(1.0f - occupied / lane.seg->_length, lod.min_speed_fac);
+}
+
+void update_segment (World& app, Segment* seg) {
 	for (auto lane : seg->all_lanes()) {
 		segment_lane_alloc(app, lane);
-
-		// brake for car in front
-		auto& vehicles = lane.vehicles();
-		for (int i=1; i<(int)vehicles.list.list.size(); ++i) {
-			Vehicle& prev = *vehicles.list.list[i-1];
-			Vehicle& cur  = *vehicles.list.list[i];
+		update_lane_lod(app.network, lane);
+
+		// brake for car in front, each vehicle directly links to its leader
+		auto* first = lane.vehicles().front();
+		for (auto* v = first ? first->sim->lane_next : nullptr; v; v = v->sim->lane_next) {
+			Vehicle& prev = *v->sim->lane_prev;
+			Vehicle& cur  = *v;
+			if (cur.sim->meso_queued) continue; // not moving
 			
 			// approx seperation using cur car bez_speed
-			float dist = (prev.sim->mot_t - cur.sim->mot_t) * cur.sim->bez_speed - (prev.asset->length() + 1);
+			float dist = (lane_vehicle_t(app.network, prev) - cur.sim->mot_t()) * cur.sim->bez_speed() - (prev.asset->length() + 1);
 
 			brake_for_dist(cur, dist);
 			dbg_brake_for_vehicle(app, cur, dist, prev);
@@ -1003,26 +1433,54 @@ void update_segment (App& app, Segment* seg) {
 }
 
 //// Node logic
-Conflict check_conflict (CachedConnection const& a, CachedConnection const& b) {
+// left and right edges of the lane corridor of a connection, which conflicts are computed from
+struct CorridorPoints {
+	float2 L[COLLISION_STEPS+1];
+	float2 R[COLLISION_STEPS+1];
+
+	CorridorPoints (Bezier3 const& bezier) {
+		auto bez2d = (Bezier2)bezier;
+		bez2d.calc_points(L, COLLISION_STEPS+1, -LANE_COLLISION_R);
+		bez2d.calc_points(R, COLLISION_STEPS+1, +LANE_COLLISION_R);
+	}
+};
+
+// intersection range of edges as u,v in [0, COLLISION_STEPS], INF/-INF if no intersections
+struct CorridorIntersect {
+	float u0 = INF;
+	float v0 = INF;
+	float u1 = -INF;
+	float v1 = -INF;
+};
+
+Conflict finish_conflict (CachedConnection const& a, CachedConnection const& b, CorridorIntersect r) {
+	r.u0 *= 1.0f / COLLISION_STEPS;
+	r.u1 *= 1.0f / COLLISION_STEPS;
+	r.v0 *= 1.0f / COLLISION_STEPS;
+	r.v1 *= 1.0f / COLLISION_STEPS;
+
+	if (a.conn.a == b.conn.a) { // same start point, code miss intersection, force it
+		r.u0 = 0; r.v0 = 0;
+	}
+	if (a.conn.b == b.conn.b) { // same end   point, code miss intersection, force it
+		r.u1 = 1; r.v1 = 1;
+	}
+
+	return { r.u0, r.u1, r.v0, r.v1 };
+}
+
+Conflict check_conflict_scalar (CachedConnection const& a, CachedConnection const& b) {
 	assert(a.conn != b.conn);
 	
-	// These are only needed for dbg vis, and on conflict cache miss
+	// These are only needed for dbg vis, and on conflict table build
 	// since computing conflicts is already expensive N(COLLISION_STEPS^2 * 4), we could just compute the points for the 2 beziers on the fly
 	// which is N(2 * (COLLISION_STEPS+1)) for the two beziers (Note: L and R can be computed at the same time)
-	float2 a_pointsL[COLLISION_STEPS+1];
-	float2 a_pointsR[COLLISION_STEPS+1];
-	float2 b_pointsL[COLLISION_STEPS+1];
-	float2 b_pointsR[COLLISION_STEPS+1];
-	{
-		auto bez2d = (Bezier2)a.bezier;
-		bez2d.calc_points(a_pointsL, COLLISION_STEPS+1, -LANE_COLLISION_R);
-		bez2d.calc_points(a_pointsR, COLLISION_STEPS+1, +LANE_COLLISION_R);
-	}
-	{
-		auto bez2d = (Bezier2)b.bezier;
-		bez2d.calc_points(b_pointsL, COLLISION_STEPS+1, -LANE_COLLISION_R);
-		bez2d.calc_points(b_pointsR, COLLISION_STEPS+1, +LANE_COLLISION_R);
-	}
+	CorridorPoints pa (a.bezier);
+	CorridorPoints pb (b.bezier);
+	auto& a_pointsL = pa.L;
+	auto& a_pointsR = pa.R;
+	auto& b_pointsL = pb.L;
+	auto& b_pointsR = pb.R;
 
 	float u0 = INF;
 	float v0 = INF;
@@ -1081,43 +1539,231 @@ Conflict check_conflict (CachedConnection const& a, CachedConnection const& b) {
 		}
 	}
 
-	u0 *= 1.0f / COLLISION_STEPS;
-	u1 *= 1.0f / COLLISION_STEPS;
-	v0 *= 1.0f / COLLISION_STEPS;
-	v1 *= 1.0f / COLLISION_STEPS;
+	return finish_conflict(a, b, { u0, v0, u1, v1 });
+}
 
-	if (a.conn.a == b.conn.a) { // same start point, code miss intersection, force it
-		u0 = 0; v0 = 0;
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+// Same computation as check_conflict_scalar with b edge segments in simd lanes, results are identical
+//  since every lane does exactly the scalar operations (no fma), and min/max reduction order does not matter
+// with AVX: lanes 0-3 are b left edge segments, 4-7 b right edge segments, 8 passes (a segments * a edges)
+// with SSE: lanes are b segments, 16 passes (a segments * a edges * b edges)
+static_assert(COLLISION_STEPS == 4, "simd check_conflict assumes 4 segments per edge");
+
+Conflict check_conflict_simd (CachedConnection const& a, CachedConnection const& b) {
+	assert(a.conn != b.conn);
+
+	CorridorPoints pa (a.bezier);
+	CorridorPoints pb (b.bezier);
+
+#ifdef __AVX__
+	// b edge segment start points and directions
+	__m256 cx  = _mm256_setr_ps(pb.L[0].x, pb.L[1].x, pb.L[2].x, pb.L[3].x,  pb.R[0].x, pb.R[1].x, pb.R[2].x, pb.R[3].x);
+	__m256 cy  = _mm256_setr_ps(pb.L[0].y, pb.L[1].y, pb.L[2].y, pb.L[3].y,  pb.R[0].y, pb.R[1].y, pb.R[2].y, pb.R[3].y);
+	__m256 cdx = _mm256_sub_ps(_mm256_setr_ps(pb.L[1].x, pb.L[2].x, pb.L[3].x, pb.L[4].x,  pb.R[1].x, pb.R[2].x, pb.R[3].x, pb.R[4].x), cx);
+	__m256 cdy = _mm256_sub_ps(_mm256_setr_ps(pb.L[1].y, pb.L[2].y, pb.L[3].y, pb.L[4].y,  pb.R[1].y, pb.R[2].y, pb.R[3].y, pb.R[4].y), cy);
+	__m256 j   = _mm256_setr_ps(0,1,2,3, 0,1,2,3);
+
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one  = _mm256_set1_ps(1.0f);
+	__m256 inf  = _mm256_set1_ps(INF);
+	__m256 ninf = _mm256_set1_ps(-INF);
+
+	__m256 u0 = inf, v0 = inf, u1 = ninf, v1 = ninf;
+
+	for (int i=0; i<COLLISION_STEPS; ++i) {
+		for (auto* edge : { pa.L, pa.R }) {
+			float2 ab = edge[i+1] - edge[i];
+			__m256 abx = _mm256_set1_ps(ab.x);
+			__m256 aby = _mm256_set1_ps(ab.y);
+
+			__m256 acx = _mm256_sub_ps(cx, _mm256_set1_ps(edge[i].x));
+			__m256 acy = _mm256_sub_ps(cy, _mm256_set1_ps(edge[i].y));
+
+			__m256 denom    = _mm256_sub_ps(_mm256_mul_ps(abx, cdy), _mm256_mul_ps(aby, cdx));
+			__m256 numer_ab = _mm256_sub_ps(_mm256_mul_ps(acx, cdy), _mm256_mul_ps(acy, cdx));
+			__m256 numer_cd = _mm256_sub_ps(_mm256_mul_ps(acx, aby), _mm256_mul_ps(acy, abx));
+			__m256 u = _mm256_div_ps(numer_ab, denom);
+			__m256 v = _mm256_div_ps(numer_cd, denom);
+
+			// same rejection as line_line_seg_intersect
+			__m256 reject = _mm256_or_ps(
+				_mm256_or_ps(_mm256_cmp_ps(u, zero, _CMP_LT_OQ), _mm256_cmp_ps(u, one, _CMP_GT_OQ)),
+				_mm256_or_ps(_mm256_cmp_ps(v, zero, _CMP_LT_OQ), _mm256_cmp_ps(v, one, _CMP_GT_OQ)));
+			reject = _mm256_or_ps(reject, _mm256_cmp_ps(denom, zero, _CMP_EQ_OQ));
+
+			u = _mm256_add_ps(u, _mm256_set1_ps((float)i));
+			v = _mm256_add_ps(v, j);
+
+			u0 = _mm256_min_ps(u0, _mm256_blendv_ps(u, inf,  reject));
+			v0 = _mm256_min_ps(v0, _mm256_blendv_ps(v, inf,  reject));
+			u1 = _mm256_max_ps(u1, _mm256_blendv_ps(u, ninf, reject));
+			v1 = _mm256_max_ps(v1, _mm256_blendv_ps(v, ninf, reject));
+		}
 	}
-	if (a.conn.b == b.conn.b) { // same end   point, code miss intersection, force it
-		u1 = 1; v1 = 1;
+
+	// reduce 8 lanes to 4 for the shared sse reduction below
+	__m128 ru0 = _mm_min_ps(_mm256_castps256_ps128(u0), _mm256_extractf128_ps(u0, 1));
+	__m128 rv0 = _mm_min_ps(_mm256_castps256_ps128(v0), _mm256_extractf128_ps(v0, 1));
+	__m128 ru1 = _mm_max_ps(_mm256_castps256_ps128(u1), _mm256_extractf128_ps(u1, 1));
+	__m128 rv1 = _mm_max_ps(_mm256_castps256_ps128(v1), _mm256_extractf128_ps(v1, 1));
+#else
+	__m128 zero = _mm_setzero_ps();
+	__m128 one  = _mm_set1_ps(1.0f);
+	__m128 inf  = _mm_set1_ps(INF);
+	__m128 ninf = _mm_set1_ps(-INF);
+	__m128 j    = _mm_setr_ps(0,1,2,3);
+
+	__m128 ru0 = inf, rv0 = inf, ru1 = ninf, rv1 = ninf;
+
+	for (auto* b_edge : { pb.L, pb.R }) {
+		__m128 cx  = _mm_setr_ps(b_edge[0].x, b_edge[1].x, b_edge[2].x, b_edge[3].x);
+		__m128 cy  = _mm_setr_ps(b_edge[0].y, b_edge[1].y, b_edge[2].y, b_edge[3].y);
+		__m128 cdx = _mm_sub_ps(_mm_setr_ps(b_edge[1].x, b_edge[2].x, b_edge[3].x, b_edge[4].x), cx);
+		__m128 cdy = _mm_sub_ps(_mm_setr_ps(b_edge[1].y, b_edge[2].y, b_edge[3].y, b_edge[4].y), cy);
+
+		for (int i=0; i<COLLISION_STEPS; ++i) {
+			for (auto* edge : { pa.L, pa.R }) {
+				float2 ab = edge[i+1] - edge[i];
+				__m128 abx = _mm_set1_ps(ab.x);
+				__m128 aby = _mm_set1_ps(ab.y);
+
+				__m128 acx = _mm_sub_ps(cx, _mm_set1_ps(edge[i].x));
+				__m128 acy = _mm_sub_ps(cy, _mm_set1_ps(edge[i].y));
+
+				__m128 denom    = _mm_sub_ps(_mm_mul_ps(abx, cdy), _mm_mul_ps(aby, cdx));
+				__m128 numer_ab = _mm_sub_ps(_mm_mul_ps(acx, cdy), _mm_mul_ps(acy, cdx));
+				__m128 numer_cd = _mm_sub_ps(_mm_mul_ps(acx, aby), _mm_mul_ps(acy, abx));
+				__m128 u = _mm_div_ps(numer_ab, denom);
+				__m128 v = _mm_div_ps(numer_cd, denom);
+
+				// same rejection as line_line_seg_intersect
+				__m128 reject = _mm_or_ps(
+					_mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)),
+					_mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(v, one)));
+				reject = _mm_or_ps(reject, _mm_cmpeq_ps(denom, zero));
+
+				u = _mm_add_ps(u, _mm_set1_ps((float)i));
+				v = _mm_add_ps(v, j);
+
+				// no blendv in sse2
+				ru0 = _mm_min_ps(ru0, _mm_or_ps(_mm_and_ps(reject, inf ), _mm_andnot_ps(reject, u)));
+				rv0 = _mm_min_ps(rv0, _mm_or_ps(_mm_and_ps(reject, inf ), _mm_andnot_ps(reject, v)));
+				ru1 = _mm_max_ps(ru1, _mm_or_ps(_mm_and_ps(reject, ninf), _mm_andnot_ps(reject, u)));
+				rv1 = _mm_max_ps(rv1, _mm_or_ps(_mm_and_ps(reject, ninf), _mm_andnot_ps(reject, v)));
+			}
+		}
 	}
+#endif
 
-	return { u0, u1, v0, v1 };
+	auto hmin = [] (__m128 x) {
+		x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1,0,3,2)));
+		x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2,3,0,1)));
+		return _mm_cvtss_f32(x);
+	};
+	auto hmax = [] (__m128 x) {
+		x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1,0,3,2)));
+		x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2,3,0,1)));
+		return _mm_cvtss_f32(x);
+	};
+
+	return finish_conflict(a, b, { hmin(ru0), hmin(rv0), hmax(ru1), hmax(rv1) });
+}
+
+Conflict check_conflict (CachedConnection const& a, CachedConnection const& b) {
+	return check_conflict_simd(a, b);
+}
+#else
+Conflict check_conflict (CachedConnection const& a, CachedConnection const& b) {
+	return check_conflict_scalar(a, b);
+}
+#endif
+
+static CachedConnection calc_conn (Node* node, SegLane in, SegLane out, int idx) {
+	CachedConnection c;
+	c.conn = { in, out };
+	c.bezier = node->calc_curve(in, out);
+	c.bez_len = c.bezier.approx_len(COLLISION_STEPS);
+	c.idx = idx;
+	c.speed_limit = get_curve_speed_limit(c.bezier, in, out);
+	return c;
+}
+std::vector<CachedConnection> Node::calc_conns () {
+	std::vector<CachedConnection> conns;
+	for (auto* seg : segments) {
+		for (auto in_lane : seg->in_lanes(this)) {
+			for (auto& out_lane : in_lane.get().connections) {
+				conns.push_back(calc_conn(this, in_lane, out_lane, (int)conns.size()));
+			}
+		}
+	}
+	return conns;
+}
+void Node::update_conflicts () {
+	ZoneScoped;
+
+	_conns = calc_conns();
+
+	// lookup tables for find_conn, follow the same order as calc_conns
+	_seg_in_lanes.resize(segments.size());
+	_in_lane_conns.clear();
+	int conn_i = 0;
+	for (auto* seg : segments) {
+		_seg_in_lanes[seg->get_slot(this)] = (int)_in_lane_conns.size();
+		for (auto in_lane : seg->in_lanes(this)) {
+			_in_lane_conns.push_back(conn_i);
+			conn_i += (int)in_lane.get().connections.size();
+		}
+	}
+	_in_lane_conns.push_back(conn_i);
+
+	int n = (int)_conns.size();
+	_conflicts.resize(n*(n-1)/2);
+	for (int a=1; a<n; ++a)
+	for (int b=0; b<a; ++b) {
+		_conflicts[a*(a-1)/2 + b] = check_conflict(_conns[a], _conns[b]);
+	}
+}
+
+int Node::find_conn (Connection const& conn) const {
+	if (!conn.a.seg || (conn.a.seg->node_a != this && conn.a.seg->node_b != this))
+		return -1;
+	int slot = conn.a.seg->get_slot(this);
+	auto in_lanes = conn.a.seg->in_lanes(this);
+	if (slot >= (int)_seg_in_lanes.size() || !in_lanes.contains(conn.a))
+		return -1;
+	
+	int lane_i = _seg_in_lanes[slot] + (conn.a.lane - in_lanes.first);
+	if (lane_i+1 >= (int)_in_lane_conns.size())
+		return -1; // lanes changed since update_conflicts
+	for (int i=_in_lane_conns[lane_i]; i<_in_lane_conns[lane_i+1]; ++i) {
+		if (_conns[i].conn == conn)
+			return i;
+	}
+	return -1;
+}
+CachedConnection Node::get_conn (SegLane const& in, SegLane const& out) {
+	int idx = find_conn({ in, out });
+	if (idx >= 0)
+		return _conns[idx];
+	return calc_conn(this, in, out, -1);
 }
 
 Conflict query_conflict (Node* node, CachedConnection const& a, CachedConnection const& b) {
 	if (a.conn == b.conn)
-		return { 0,1, 0,1 }; // never cache overlapping paths
+		return { 0,1, 0,1 }; // overlapping paths always conflict fully
 	
-	// order a/b in some order in hashmap key to save 50% of (symmetrical) conflicts
-	bool order = a.conn < b.conn;
-
-	auto* pa = &a;
-	auto* pb = &b;
-	if (!order) std::swap(pa, pb);
+	if (a.idx < 0 || b.idx < 0)
+		return check_conflict(a, b); // not a lane connection of the node, can't be in the table
 	
-	ConflictKey key = ConflictKey{ pa->conn, pb->conn };
-
-	auto conf = node->vehicles.conflict_cache.get_or_create(key, [&] () -> Conflict {
-		return check_conflict(*pa, *pb); // cache ordered conflict
-	});
-
-	// reverse ordering for result, effectively reusing b->a conflict as a->b
-	return order ? conf : Conflict{ conf.b_t0, conf.b_t1, conf.a_t0, conf.a_t1 };
+	// only a > b stored, reverse result to reuse b->a conflict as a->b
+	if (a.idx > b.idx)
+		return node->_conflicts[a.idx*(a.idx-1)/2 + b.idx];
+	
+	auto& conf = node->_conflicts[b.idx*(b.idx-1)/2 + a.idx];
+	return Conflict{ conf.b_t0, conf.b_t1, conf.a_t0, conf.a_t1 };
 }
 
-bool dbg_conflicts (App& app, Node* node, Vehicle& veh) {
+bool dbg_conflicts (World& app, Node* node, Vehicle& veh) {
 	int idx = kiss::indexof(node->vehicles.test.list, &veh, [&] (NodeVehicle const& l, Vehicle const* r) { return l.veh == r; });
 	if (idx < 0)
 		return false;
@@ -1146,7 +1792,7 @@ bool dbg_conflicts (App& app, Node* node, Vehicle& veh) {
 	};
 
 	// visualized vehicle's path through node as thick yellow arrow
-	float mot_t = a.front_k < 0 ? 0.0f : clamp(a.veh->sim->mot_t, 0.0f, 1.0f);
+	float mot_t = a.front_k < 0 ? 0.0f : clamp(a.veh->sim->mot_t(), 0.0f, 1.0f);
 	app.overlay.curves.push_arrow(a.conn.bezier, sz, OverlayDraw::TEXTURE_THICK_ARROW, lrgba(0.9f,0.9f,0.1f, 0.9f), float2(mot_t, 1));
 	
 	// loop over all previous cars (higher prio to yield for)
@@ -1209,7 +1855,7 @@ NodeVehicle* get_left_vehicle (Node* node, NodeVehicle& a, NodeVehicle& b) {
 	if (b_turn == Turns::LEFT && a_turn != Turns::LEFT) return &b;
 	return nullptr;
 }
-void yield_for_car (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg) {
+void yield_for_car (World& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg) {
 	// WARNING: a and b are kinda the wrong way around, b is on the left, ie. yielded for
 	// TODO: rename these
 	assert(a.veh != b.veh);
@@ -1224,17 +1870,17 @@ void yield_for_car (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool d
 	auto b_lane = get_incoming_lane(b);
 	if (a_lane && a_lane == b_lane) {
 		// in same lane, failsafe for bug
-		assert(a_lane.vehicles().list.list == b_lane.vehicles().list.list);
-		int a_idx = indexof(a_lane.vehicles().list.list, a.veh);
-		int b_idx = indexof(a_lane.vehicles().list.list, b.veh);
-		assert(a_idx >= 0 && b_idx >= 0 && a_idx != b_idx);
-		if (a_idx < b_idx) {
+		assert(a.veh->sim->mot.cur_vehicles == b.veh->sim->mot.cur_vehicles);
+		if (a_lane.vehicles().is_ahead(a.veh, b.veh)) {
 			// out of order in node vs segment order, this causes deadlocks!
 			std::swap(a, b); // swap to fix
 			return; // no need to yield, because already handled by segment logic
 		}
 	}
-
+	
+	// mesoscopic vehicles only wait for lane space and traffic lights at nodes, not for each other
+	if (a.veh->sim->meso && b.veh->sim->meso)
+		return;
 
 	auto conf = query_conflict(node, a.conn, b.conn);
 	
@@ -1282,8 +1928,8 @@ void yield_for_car (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool d
 	}
 	else {
 		// TODO: calc this in query_conflict?
-		float a_eta = (a_k0 - a.front_k) / (a.veh->sim->speed + 1.0f);
-		float b_eta = (b_k0 - b.front_k) / (b.veh->sim->speed + 1.0f);
+		float a_eta = (a_k0 - a.front_k) / (a.veh->sim->speed() + 1.0f);
+		float b_eta = (b_k0 - b.front_k) / (b.veh->sim->speed() + 1.0f);
 
 		// max .5m past stop line
 		bool behind_stop_line = app.network.settings.intersec_heur.avoid_blocking_intersection &&
@@ -1315,7 +1961,7 @@ void yield_for_car (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool d
 		a.blocked = true; // so swapping can let other go first if we are effectively blocked
 
 }
-bool swap_cars (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg, int b_idx) {
+bool swap_cars (World& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg, int b_idx) {
 	assert(a.veh != b.veh);
 
 	bool swap_valid = true;
@@ -1367,7 +2013,7 @@ bool swap_cars (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg,
 		if (conf) {
 			float k0 = conf_t0 * v.conn.bez_len;
 
-			float conf_eta = (k0 - v.front_k) / (v.veh->sim->speed + 1.0f);
+			float conf_eta = (k0 - v.front_k) / (v.veh->sim->speed() + 1.0f);
 			
 			penalty += clamp(map(conf_eta, 1.0f, 6.0f), 0.0f, 1.0f) * heur.conflict_eta_penal;
 		}
@@ -1380,7 +2026,7 @@ bool swap_cars (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg,
 			penalty += heur.yield_lane_penal;
 		
 		// eta to leave intersection
-		float exit_eta = (v.conn.bez_len - v.front_k) / (v.veh->sim->speed + 1.0f);
+		float exit_eta = (v.conn.bez_len - v.front_k) / (v.veh->sim->speed() + 1.0f);
 		penalty += clamp(map(exit_eta, 1.0f, 6.0f), 0.0f, 1.0f) * heur.exit_eta_penal;
 
 		// priority for progress through intersection
@@ -1429,7 +2075,7 @@ bool swap_cars (App& app, Node* node, NodeVehicle& a, NodeVehicle& b, bool dbg,
 	return do_swap;
 }
 
-void update_node (App& app, Node* node, float dt) {
+void update_node (World& app, Node* node, float dt) {
 	bool node_dbg = app.interact.selection.get<Node*>() == node;
 
 	auto* sel  = app.interact.selection.get<Vehicle*>();
@@ -1444,25 +2090,28 @@ void update_node (App& app, Node* node, float dt) {
 	auto track_node_vehicle = [node] (Vehicle* veh, Path::Motion const& state) {
 		NodeVehicle nv = { veh };
 		nv.wait_time = 0;
-		nv.conn.conn = { state.cur_lane, state.next_lane };
-		nv.conn.bezier = node->calc_curve(nv.conn.conn.a, nv.conn.conn.b);
-		nv.conn.bez_len = nv.conn.bezier.approx_len(COLLISION_STEPS);
+		nv.conn = node->get_conn(state.cur_lane, state.next_lane);
 		return nv;
 	};
 
 	// Add vehicles close to intersection to tracked list
 	for (auto& seg : node->segments) {
 		for (auto lane : seg->in_lanes(node)) {
-			auto it = lane.vehicles().list.list.begin();
 			// add vehicles if not already in list
-			while (it != lane.vehicles().list.list.end()) { auto* v = *it++;
-				if (node->vehicles.test.contains(v)) continue; // TODO: Expensive contains with vector
-
-				float dist = (1.0f - v->sim->mot_t) * v->sim->bez_speed;
-				if (dist < 10.0f || v == lane.vehicles().list.list.front()) {
+			for (auto* v : lane.vehicles()) {
+				if (v->sim->tracking_node == node) continue;
+				// queued mesoscopic vehicles are tracked once they leave the queue at the end of the lane
+				if (v->sim->meso_queued) break;
+
+				float dist = (1.0f - v->sim->mot_t()) * v->sim->bez_speed();
+				// mesoscopic vehicles change speed instantly, so don't need to see the node from further away
+				if (dist < 10.0f || (v == lane.vehicles().front() && !v->sim->meso)) {
 					auto* n = v->sim->mot.get_cur_node();
 					if (n == node) {
-						node->vehicles.test.add(track_node_vehicle(v, v->sim->mot));
+						node->vehicles.test.list.push_back(track_node_vehicle(v, v->sim->mot));
+						if (v->sim->tracking_node)
+							v->sim->prev_tracking_nodes.push_back(v->sim->tracking_node);
+						v->sim->tracking_node = node;
 					}
 				}
 				else {
@@ -1477,24 +2126,28 @@ void update_node (App& app, Node* node, float dt) {
 			// ingoing lane
 			if (state.motion == Path::SEGMENT) {
 				// extrapolate and map from negative to 0
-				v.front_k = (v.veh->sim->mot_t - 1.0f) * v.veh->sim->bez_speed;
+				v.front_k = (v.veh->sim->mot_t() - 1.0f) * v.veh->sim->bez_speed();
 			}
 			// on node
 			else {
 				assert(state.motion == Path::NODE);
 				// approximate by just mapping t (which is wrong)
-				v.front_k = v.veh->sim->mot_t * v.conn.bez_len;
+				v.front_k = v.veh->sim->mot_t() * v.conn.bez_len;
 			}
 		}
 		// assume outgoing lane (update should never move vehicle by more than one segment per tick!)
 		else {
 			// extrapolate and map from negative to 0
-			v.front_k = v.veh->sim->mot_t * v.veh->sim->bez_speed + v.conn.bez_len;
+			v.front_k = v.veh->sim->mot_t() * v.veh->sim->bez_speed() + v.conn.bez_len;
 		}
 		
 		v.rear_k = v.front_k - v.veh->asset->length();
 	};
 
+	// phase is the same for all vehicles waiting at this node
+	TrafficLight::CurPhase cur_phase;
+	if (node->traffic_light) cur_phase = node->traffic_light->decode_phase();
+
 	// update each tracked vehicle
 	// allocate space in priority order and remember blocked cars
 	for (auto& v : node->vehicles.test.list) {
@@ -1515,8 +2168,7 @@ void update_node (App& app, Node* node, float dt) {
 			// still in front of intersection, respect traffic lights
 			auto in_lane = v.conn.conn.a;
 
-			auto cur_phase = node->traffic_light->decode_phase();
-			auto signal_slot = node->traffic_light->_find_signal_slot(node, in_lane);
+			auto signal_slot = node->traffic_light->get_signal_slot(node, in_lane);
 			auto lane_signal = node->traffic_light->get_signal(cur_phase, signal_slot);
 
 			if (lane_signal == TrafficLight::RED) {
@@ -1550,7 +2202,9 @@ void update_node (App& app, Node* node, float dt) {
 		//auto& motion = v.vehicle->get_motion();
 
 		float dist = v.front_k - v.conn.bez_len;
-		return dist > v.veh->asset->length();
+		bool clear = dist > v.veh->asset->length();
+		if (clear) node->vehicles.dropped.push_back(v.veh);
+		return clear;
 	});
 
 	int count = (int)node->vehicles.test.list.size();
@@ -1567,9 +2221,9 @@ void update_node (App& app, Node* node, float dt) {
 		//// loop over the last vehicle in each outgoing line
 		//for (auto& seg : node->segments) {
 		//	for (auto lane : seg->out_lanes(node)) {
-		//		if (lane.vehicles().list.list.empty())
+		//		if (lane.vehicles().empty())
 		//			continue;
-		//		auto* v = lane.vehicles().list.list.back();
+		//		auto* v = lane.vehicles().back();
 		//		NodeVehicle b = track_node_vehicle(v, v->path.get_state());
 		//
 		//		// compute intersection progress value 'k'
@@ -1593,12 +2247,12 @@ void update_node (App& app, Node* node, float dt) {
 		}
 
 		// brake for dest lane car
-		auto& dest_lane = a.conn.conn.b.vehicles().list.list;
+		auto& dest_lane = a.conn.conn.b.vehicles();
 		if (!dest_lane.empty() && dest_lane.back() != a.veh) {
 			float a_front_k = a.front_k - a.conn.bez_len; // relative to after node
 
 			auto* b = dest_lane.back();
-			float b_rear_k = b->sim->mot_t * b->sim->bez_speed - b->asset->length();
+			float b_rear_k = b->sim->mot_t() * b->sim->bez_speed() - b->asset->length();
 
 			float dist = b_rear_k - a_front_k;
 			dist -= SAFETY_DIST;
@@ -1660,8 +2314,8 @@ float calc_car_deccel (float base_deccel, float target_speed, float cur_speed) {
 void update_vehicle_suspension (Network& net, SimVehicle& veh, float3 local_accel, float dt) {
 	// assume constant mass
 
-	float3 ang = veh.suspension_ang;
-	float3 vel = veh.suspension_ang_vel;
+	float3 ang = veh.vis.suspension_ang;
+	float3 vel = veh.vis.suspension_ang_vel;
 
 	// spring resitive accel
 	//float2 accel = -ang * app.net.settings.suspension_spring_k;
@@ -1681,48 +2335,102 @@ void update_vehicle_suspension (Network& net, SimVehicle& veh, float3 local_acce
 	ang += vel * dt;
 	ang = clamp(ang, -net.settings.suspension.max, +net.settings.suspension.max);
 
-	veh.suspension_ang = ang;
-	veh.suspension_ang_vel = vel;
+	veh.vis.suspension_ang = ang;
+	veh.vis.suspension_ang_vel = vel;
 }
 void update_wheel_roll (SimVehicle& veh, float delta_dist, VehicleAsset* vehicle_asset) {
 	float wheel_circum = vehicle_asset->wheel_r * (2*PI);
 
-	veh.wheel_roll += delta_dist / wheel_circum;
-	veh.wheel_roll = fmodf(veh.wheel_roll, 1.0f);
+	veh.vis.wheel_roll += delta_dist / wheel_circum;
+	veh.vis.wheel_roll = fmodf(veh.vis.wheel_roll, 1.0f);
+}
+
+void LaneVehicles::insert_after (Vehicle* veh, Vehicle* leading) {
+	auto* sim = veh->sim.get();
+	assert(!sim->lane_prev && !sim->lane_next && head != veh);
+
+	Vehicle* trailing = leading ? leading->sim->lane_next : head;
+
+	sim->lane_prev = leading;
+	sim->lane_next = trailing;
+	if (leading)  leading->sim->lane_next = veh;
+	else          head = veh;
+	if (trailing) trailing->sim->lane_prev = veh;
+	else          tail = veh;
+
+	count++;
+}
+void LaneVehicles::remove (Vehicle* veh) {
+	auto* sim = veh->sim.get();
+	assert(sim->lane_prev || head == veh);
+
+	if (sim->lane_prev) sim->lane_prev->sim->lane_next = sim->lane_next;
+	else                head = sim->lane_next;
+	if (sim->lane_next) sim->lane_next->sim->lane_prev = sim->lane_prev;
+	else                tail = sim->lane_prev;
+
+	sim->lane_prev = nullptr;
+	sim->lane_next = nullptr;
+	count--;
+}
+bool LaneVehicles::try_remove (Vehicle* veh) {
+	if (!veh->sim->lane_prev && head != veh)
+		return false;
+	remove(veh);
+	return true;
+}
+void LaneVehicles::clear () {
+	for (auto* v = head; v;) {
+		auto* next = v->sim->lane_next;
+		v->sim->lane_prev = nullptr;
+		v->sim->lane_next = nullptr;
+		v = next;
+	}
+	head = nullptr;
+	tail = nullptr;
+	count = 0;
+}
+bool LaneVehicles::is_ahead (Vehicle* a, Vehicle* b) const {
+	for (auto* v = b->sim->lane_prev; v; v = v->sim->lane_prev) {
+		if (v == a) return true;
+	}
+	return false;
 }
 
 LaneVehicles::FindResult LaneVehicles::find_lane_spot (float mot_t) const {
 	FindResult res;
-	int i = 0;
-	for (; i<(int)list.list.size(); ++i) { // iterate lane from front
-		auto* v = list.list[i];
-		float rear_t = v->sim->mot_t - v->asset->length() / v->sim->bez_speed;
+	for (auto* v : *this) { // iterate lane from front
+		// queued mesoscopic vehicles have no current position, keep queue order
+		if (v->sim->meso_queued) {
+			res.leading = v;
+			continue;
+		}
+		float rear_t = v->sim->mot_t() - v->asset->length() / v->sim->bez_speed();
 		if (rear_t <= mot_t) {
 			res.trailing = v;
 			break; // found first vehicle earlier in lane than mot_t
 		}
 		res.leading = v;
 	}
-	res.idx = i;
 	return res;
 };
 void LaneVehicles::find_spot_and_insert (Vehicle* veh) {
-	auto res = find_lane_spot(veh->sim->mot_t);
-	list.insert(veh, res.idx);
+	auto res = find_lane_spot(veh->sim->mot_t());
+	insert_after(veh, res.leading);
 }
 
-void yield_enter_segment (App& app, Vehicle& veh) {
+void yield_enter_segment (World& app, Vehicle& veh) {
 	if (veh.sim->mot.motion != Path::START)
 		return;
 
 	SegLane merge_lane = veh.sim->mot.next_lane;
 	float merge_lane_t = veh.sim->mot.next_start_t;
-	float dist_to_merge = (1.0f - veh.sim->mot_t) * veh.sim->bez_speed;
+	float dist_to_merge = (1.0f - veh.sim->mot_t()) * veh.sim->bez_speed();
 
-	float dist_to_wait = (0.3f - veh.sim->mot_t) * veh.sim->bez_speed;
+	float dist_to_wait = (0.3f - veh.sim->mot_t()) * veh.sim->bez_speed();
 	
 	auto brake_for_other = [&] (Vehicle& other) {
-		float other_rear_after_merge = (other.sim->mot_t - merge_lane_t) * other.sim->bez_speed;
+		float other_rear_after_merge = (other.sim->mot_t() - merge_lane_t) * other.sim->bez_speed();
 		other_rear_after_merge -= other.asset->length() - SAFETY_DIST;
 
 		float dist = other_rear_after_merge + dist_to_merge;
@@ -1731,7 +2439,7 @@ void yield_enter_segment (App& app, Vehicle& veh) {
 		dbg_brake_for_vehicle(app, veh, dist, other);
 	};
 	auto other_brake_for_us = [&] (Vehicle& other) {
-		float other_dist_to_merge = (merge_lane_t - other.sim->mot_t) * other.sim->bez_speed;
+		float other_dist_to_merge = (merge_lane_t - other.sim->mot_t()) * other.sim->bez_speed();
 		float us_space_after_merge = dist_to_merge - veh.asset->length() - SAFETY_DIST;
 
 		float dist = other_dist_to_merge + us_space_after_merge;
@@ -1762,11 +2470,11 @@ void yield_enter_segment (App& app, Vehicle& veh) {
 	lane_alloc_reserve(app, merge_lane, veh);
 }
 
-void vehicle_update_speed (Vehicle& veh, Network& net, Metrics::Var& met, float dt) {
+void vehicle_update_speed (Vehicle& veh, Network& net, float dt) {
 	float speed_limit = veh.sim->mot.cur_speedlim;
 	float aggress = veh.aggressiveness_topspeed_accel_mul();
 	{
-		float remain_dist = (veh.sim->mot.end_t - veh.sim->mot_t) * veh.sim->bez_speed;
+		float remain_dist = (veh.sim->mot.end_t - veh.sim->mot_t()) * veh.sim->bez_speed();
 		if (remain_dist <= 5.0f) {
 			speed_limit = lerp(veh.sim->mot.cur_speedlim, veh.sim->mot.next_speedlim, map(remain_dist, 5.0f, 0.0f));
 		}
@@ -1775,13 +2483,13 @@ void vehicle_update_speed (Vehicle& veh, Network& net, Metrics::Var& met, float
 		speed_limit = max(speed_limit, 1.0f);
 	}
 
-	float old_speed = veh.sim->speed;
+	float old_speed = veh.sim->speed();
 	float new_speed = old_speed;
 	
 	veh.sim->brake_light = 0.0f;
 
 	// car speed change
-	float target_speed = speed_limit * veh.sim->brake;
+	float target_speed = speed_limit * veh.sim->brake();
 	if (target_speed < 0.33f) target_speed = 0;
 
 	if (target_speed > new_speed) {
@@ -1798,10 +2506,22 @@ void vehicle_update_speed (Vehicle& veh, Network& net, Metrics::Var& met, float
 			veh.sim->brake_light = 1.0f;
 	}
 
-	veh.sim->speed = new_speed;
+	veh.sim->speed() = new_speed;
 
-	met.total_flow += veh.sim->speed / speed_limit;
-	met.total_flow_weight += 1;
+	veh.sim->flow = veh.sim->speed() / speed_limit;
+}
+// mesoscopic vehicles drive at lane speed from occupancy without accelerating, but still brake for leader, lights etc.
+void meso_update_speed (Vehicle& veh, Network& net) {
+	float speed_limit = veh.sim->mot.cur_speedlim * veh.aggressiveness_topspeed_accel_mul();
+	speed_limit = max(speed_limit, 1.0f);
+
+	float target_speed = speed_limit * veh.sim->mot.cur_vehicles->meso_speed_fac * veh.sim->brake();
+	if (target_speed < 0.33f) target_speed = 0;
+
+	veh.sim->speed() = target_speed;
+	veh.sim->brake_light = 0.0f;
+
+	veh.sim->flow = veh.sim->speed() / speed_limit;
 }
 void vehicle_update_animation (Vehicle& veh, Network& net, float3 new_front, float turn_curv, float delta_dist, float dt) {
 	
@@ -1820,15 +2540,31 @@ void vehicle_update_animation (Vehicle& veh, Network& net, float3 new_front, flo
 
 	veh.sim->front_pos = new_front;
 	veh.sim->rear_pos  = new_rear;
+
+	auto& vis = veh.sim->vis;
+	// visuals only while visible, mesoscopic vehicles have no curvature
+	if (!vis.visible || veh.sim->meso) {
+		vis.valid = false;
+		return;
+	}
 	
 	// totally wack with car_rear_drag_ratio
-	veh.sim->turn_curv = turn_curv; // TODO: to be correct for wheel turning this would need to be computed based on the rear axle
+	vis.turn_curv = turn_curv; // TODO: to be correct for wheel turning this would need to be computed based on the rear axle
 
 	{
 		float3 old_center = (old_front + old_rear) * 0.5f;
 		float3 new_center = (new_front + new_rear) * 0.5f;
 		float3 cen_vel   = dt == 0 ? 0 : (new_center - old_center) / dt;
-		float3 cen_accel = dt == 0 ? 0 : (cen_vel - veh.sim->center_vel) / dt;
+
+		if (!vis.valid) {
+			// just became visible, start at rest relative to current motion instead of a huge accel from stale velocity
+			vis.center_vel = float3(cen_vel, 0);
+			vis.suspension_ang = 0;
+			vis.suspension_ang_vel = 0;
+			vis.valid = true;
+		}
+
+		float3 cen_accel = dt == 0 ? 0 : (cen_vel - vis.center_vel) / dt;
 		
 		// accel from world to local space
 		//float accel_cap = 30; // we get artefacts with huge accelerations due to discontinuities, cap accel to hide
@@ -1858,7 +2594,7 @@ void vehicle_update_animation (Vehicle& veh, Network& net, float3 new_front, flo
 		}
 	#endif
 
-		veh.sim->center_vel = float3(cen_vel, 0);
+		vis.center_vel = float3(cen_vel, 0);
 
 		update_wheel_roll(*veh.sim, delta_dist, veh.asset);
 	}
@@ -1889,19 +2625,19 @@ void update_standing_vehicle (Vehicle& veh, Network& net, float dt) {
 		veh.sim->init_pos(pos, veh.asset);
 	}
 
-	vehicle_update_animation(veh, net, veh.sim->front_pos, 0, 0, dt);
+	veh.sim->anim_step = { veh.sim->front_pos, 0, 0 };
 }
 
-bool Vehicle::update (Path& path, App& app, Network& net, Metrics::Var& met, float dt) {
+bool Vehicle::update (Path& path, World& app, Network& net, float dt) {
 	
 //// startup/shutdown anim special case
 	if (sim->mot.motion == Path::STARTUP || sim->mot.motion == Path::SHUTDOWN) {
 		update_standing_vehicle(*this, net, dt);
 
-		sim->mot_t += dt / SimVehicle::STARTUP_DURATION;
+		sim->mot_t() += dt / SimVehicle::STARTUP_DURATION;
 
-		if (sim->mot_t >= 1.0f) {
-			sim->mot_t = 0.0f;
+		if (sim->mot_t() >= 1.0f) {
+			sim->mot_t() = 0.0f;
 
 			if (sim->mot.motion == Path::STARTUP) {
 				// startup anim done, update normally next frame
@@ -1921,39 +2657,57 @@ bool Vehicle::update (Path& path, App& app, Network& net, Metrics::Var& met, flo
 	}
 
 ////
+	// waiting in lane queue, leaves it in update_lane_lod
+	if (sim->meso_queued)
+		return false;
+
+	if (sim->sleeping) {
+		if (sim->brake() == 0.0f) {
+			// nothing changed since it stopped, same result as a full update with speed and brake 0
+			sim->flow = 0.0f;
+			if (sim->vis.visible && !sim->meso) // let suspension settle
+				sim->anim_step = { sim->front_pos, sim->vis.turn_curv, 0 };
+			return false;
+		}
+		sim->sleeping = false;
+	}
+
 	yield_enter_segment(app, *this);
 
 	// mot_t == mot.end_t can happen due to extrapolation between curves
-	assert(sim->mot_t <= 1.0f);
+	assert(sim->mot_t() <= 1.0f);
 	
-	vehicle_update_speed(*this, net, met, dt);
+	if (sim->meso && sim->mot.motion == Path::SEGMENT)
+		meso_update_speed(*this, net);
+	else
+		vehicle_update_speed(*this, net, dt);
 	
 	// move car with speed on bezier based on previous frame delta t
-	float delta_dist = sim->speed * dt;
-	sim->mot_t += delta_dist / sim->bez_speed;
+	float delta_dist = sim->speed() * dt;
+	sim->mot_t() += delta_dist / sim->bez_speed();
 
 	// do bookkeeping when car reaches end of current bezier
-	if (sim->mot_t >= sim->mot.end_t) {
-		if (sim->mot.cur_vehicles) sim->mot.cur_vehicles->list.remove(this);
+	if (sim->mot_t() >= sim->mot.end_t) {
+		if (sim->mot.cur_vehicles) sim->mot.cur_vehicles->remove(this);
 
 		if (sim->mot.motion == Path::END) {
 			// update animation for this call, but don't evaulate bezier anymore
-			vehicle_update_animation(*this, net, sim->front_pos, sim->turn_curv, delta_dist, dt);
+			sim->anim_step = { sim->front_pos, sim->vis.turn_curv, delta_dist };
 
 			// trigger shutdown anim next update
 			sim->mot = {};
 			sim->mot.motion = Path::SHUTDOWN;
-			sim->mot_t = 0;
+			sim->mot_t() = 0;
 			// reset some vars just to make sure
-			sim->speed = 0;
-			sim->bez_speed = INF;
+			sim->speed() = 0;
+			sim->bez_speed() = INF;
 			return false;
 		}
 		else {
-			float additional_dist = (sim->mot_t - sim->mot.end_t) * sim->bez_speed;
-			sim->mot_t = sim->mot.next_start_t;
+			float additional_dist = (sim->mot_t() - sim->mot.end_t) * sim->bez_speed();
+			sim->mot_t() = sim->mot.next_start_t;
 
-			assert(sim->mot_t >= 0 && sim->mot_t < 1);
+			assert(sim->mot_t() >= 0 && sim->mot_t() < 1);
 
 			path.step_vehicle(net, *this);
 
@@ -1961,10 +2715,10 @@ bool Vehicle::update (Path& path, App& app, Network& net, Metrics::Var& met, flo
 			if (sim->mot.cur_vehicles) sim->mot.cur_vehicles->find_spot_and_insert(this);
 
 			// avoid visible jerk between bezier curves by extrapolating t
-			auto start_bez_speed = length(sim->mot.bezier.eval(sim->mot_t).vel);
+			auto start_bez_speed = length(sim->mot.bezier.eval(sim->mot_t()).vel);
 			assert(additional_dist >= 0.0f);
 			float additional_t = additional_dist / start_bez_speed;
-			sim->mot_t = min(sim->mot_t + additional_t, sim->mot.end_t);
+			sim->mot_t() = min(sim->mot_t() + additional_t, sim->mot.end_t);
 
 			{
 				float blnk = 0;
@@ -1980,16 +2734,24 @@ bool Vehicle::update (Path& path, App& app, Network& net, Metrics::Var& met, flo
 		}
 	}
 
-	// eval bezier at car front
-	auto bez_res = sim->mot.bezier.eval_with_curv(sim->mot_t);
+	// eval bezier at car front, mesoscopic vehicles don't need curvature (stays 0)
+	auto bez_res = sim->meso ? sim->mot.bezier.eval(sim->mot_t()) : sim->mot.bezier.eval_with_curv(sim->mot_t());
 	// remember bezier delta t for next frame
-	sim->bez_speed = length(bez_res.vel); // delta pos / bezier t
+	sim->bez_speed() = length(bez_res.vel); // delta pos / bezier t
 	// some Beziers can have points with 0 speed, which breaks the code (bezier step would end up with inf step size)
 	// so some step size has to be chosen, we could approximate this in some way, but simply limiting to something
 	// arbitrary works
-	sim->bez_speed = max(sim->bez_speed, 1.0f);
+	sim->bez_speed() = max(sim->bez_speed(), 1.0f);
+
+	sim->anim_step = { bez_res.pos, bez_res.curv, delta_dist };
+
+	// mot_t can equal end_t after extrapolation, which still needs a step next update
+	if (sim->mot.motion == Path::SEGMENT && sim->speed() == 0.0f && sim->brake() == 0.0f && sim->mot_t() < sim->mot.end_t)
+		sim->sleeping = true;
 
-	vehicle_update_animation(*this, net, bez_res.pos, bez_res.curv, delta_dist, dt);
+	// mesoscopic vehicles in a lane are queued once no node tracks them anymore
+	if (sim->meso && sim->mot.motion == Path::SEGMENT && !sim->tracking_node && sim->prev_tracking_nodes.empty())
+		meso_enqueue(net, *this);
 	return false;
 }
 
@@ -2003,6 +2765,8 @@ void Path::begin_vehicle_trip (Network& net, Vehicle& veh) {
 	assert(!veh.sim);
 	veh.sim = std::make_unique<SimVehicle>();
 	veh.sim->path = this;
+	veh.sim->states = &net.vehicle_states;
+	veh.sim->id = net.vehicle_states.alloc();
 
 	veh.sim->mot = get_motion(net, 0, nullptr, veh, false);
 	veh.sim->mot.motion = STARTUP; // do STARTUP instead of START, TODO: does this make sense?
@@ -2036,147 +2800,458 @@ void Path::finish_vehicle_trip (Vehicle& veh) {
 	veh.sim = nullptr;
 }
 
-bool PersonTrip::begin_trip (Person& person, Network& net, Entities& entities, Random& rand) {
+void PersonTrip::request_trip (Person& person, Network& net, Entities& entities, Random& rand) {
 	auto* dest_building = entities.buildings[ rand.uniformi(0, (int)entities.buildings.size()) ].get();
 	
 	assert(person.cur_building->connected_segment);
 	if (person.cur_building->connected_segment) {
-		ZoneScoped;
+		Path::PathEnd start = { person.cur_building->connected_segment };
+		Path::PathEnd dest  = { dest_building->connected_segment };
 
-		auto trip = std::make_unique<network::PersonTrip>();
-		auto& veh = *person.owned_vehicle;
-		
-		Path::Endpoint start = { person.cur_building, veh.parking };
-		Path::Endpoint dest  = { dest_building };
+		net.pathfind_queue.request(net, person, dest_building, start, dest);
+		return;
+	}
 
-		// pathfind
-		auto path = trip->path.begin(net, start, dest);
-		if (path) {
-			trip->path = std::move(*path);
+	person.stay_timer = 1;
+	net.person_scheduler.schedule(person, person.stay_timer);
+}
+void PersonTrip::begin_trip (Person& person, Network& net, Building* dest_building, PathSegments const& segments) {
+	ZoneScoped;
 
-			// begin simulating vehicle
-			trip->path.begin_vehicle_trip(net, veh);
-			// person exit building
-			person.cur_building = nullptr;
+	auto trip = std::make_unique<network::PersonTrip>();
+	auto& veh = *person.owned_vehicle;
+	
+	trip->path.start = { person.cur_building, veh.parking };
+	trip->path.dest  = { dest_building };
+	trip->path.path  = segments;
+	trip->path.seed  = ((uint64_t)person._id << 32) | person._trip_count++;
 
-			person.trip = std::move(trip);
-			return true;
-		}
-	}
+	// begin simulating vehicle
+	trip->path.begin_vehicle_trip(net, veh);
+	// person exit building
+	person.cur_building = nullptr;
 
-	person.stay_timer = 1;
-	return false;
+	person.trip = std::move(trip);
+	net.add_active_person(person);
 }
-void PersonTrip::cancel_trip (Person& person) {
+void PersonTrip::cancel_trip (Person& person, Network& net) {
 	// reset person back to start building
 	person.cur_building = path.start.building;
 
 	// stop simulating vehicle (default to pocket car)
 	path.cancel_vehicle_trip(*person.owned_vehicle);
+	net.remove_active_person(person);
 
 	// delete trip
 	path._dtor(*person.owned_vehicle);
 	person.trip = nullptr; // delete self
 
 	person.stay_timer = 1;
+	net.person_scheduler.schedule(person, person.stay_timer);
 }
-void PersonTrip::finish_trip (Person& person) {
+void PersonTrip::finish_trip (Person& person, Network& net) {
 	ZoneScoped;
 	// person enter dest building
 	person.cur_building = path.dest.building;
 
 	// 
 	path.finish_vehicle_trip(*person.owned_vehicle);
+	net.remove_active_person(person);
 
 	// delete trip
 	path._dtor(*person.owned_vehicle);
 	person.trip = nullptr; // delete self
 }
 
-void PersonTrip::update (App& app, Person& person, Network& net, Entities& entities, Metrics::Var& met, Random& rand, float dt) {
-	if (person.cur_building) {
-		// Person in building, wait for timer to start trip
-		if (!wait_for(person.stay_timer, dt))
-			return; // waiting
+void PersonTrip::update_vehicle (World& app, Person& person, Network& net, float dt) {
+	auto* veh = person.owned_vehicle.get();
+	assert(veh && veh->sim);
+
+	if (!veh->update(person.trip->path, app, net, dt))
+		return; // trip ongoing
+
+	person.trip->finish_trip(person, net);
+	person.stay_timer = net._stay_time;
+	net.person_scheduler.schedule(person, person.stay_timer);
+}
+
+void Network::add_active_person (Person& person) {
+	assert(person._active_idx < 0);
+	person._active_idx = (int)active_persons.size();
+	active_persons.push_back(&person);
+}
+void Network::remove_active_person (Person& person) {
+	int idx = person._active_idx;
+	assert(idx >= 0 && active_persons[idx] == &person);
+
+	// swap with last
+	active_persons[idx] = active_persons.back();
+	active_persons[idx]->_active_idx = idx;
+	active_persons.pop_back();
+
+	person._active_idx = -1;
+}
+
+void PersonScheduler::schedule (Person& person, float delay) {
+	assert(person._id >= 0);
+	// round up, never wake early
+	uint64_t due = (uint64_t)ceil((time + (double)delay) / (double)TICK);
+	due = max(due, cur_tick);
 
-		if (!begin_trip(person, net, entities, rand)) {
-			assert(person.cur_building);
-			return; // start_trip failed
+	_insert({ due, next_order++, person._id });
+	count++;
+}
+void PersonScheduler::_insert (Entry const& e) {
+	assert(e.due >= cur_tick);
+	uint64_t delta = e.due - cur_tick;
+
+	for (int level=0; level<LEVELS; ++level) {
+		if (delta < (1ull << (SLOT_BITS * (level+1)))) {
+			wheels[level][(e.due >> (SLOT_BITS * level)) & (SLOTS-1)].push_back(e);
+			return;
 		}
+	}
+	overflow.push_back(e);
+}
+void PersonScheduler::_process_tick (uint64_t tick, std::vector<int>& woken) {
+	auto cascade = [&] (std::vector<Entry>& slot) {
+		auto entries = std::move(slot);
+		slot.clear();
+		for (auto& e : entries)
+			_insert(e);
+	};
 
-		dt = 0; // 0 dt timestep to init some values properly
+	// at the start of each lap of a coarse level, move its current slot into finer levels, coarsest first
+	if ((tick & ((1ull << (SLOT_BITS * LEVELS)) - 1)) == 0)
+		cascade(overflow);
+	for (int level=LEVELS-1; level>=1; --level) {
+		if ((tick & ((1ull << (SLOT_BITS * level)) - 1)) == 0)
+			cascade(wheels[level][(tick >> (SLOT_BITS * level)) & (SLOTS-1)]);
 	}
 
-	auto* veh = person.owned_vehicle.get();
-	assert(veh && veh->sim);
+	auto& slot = wheels[0][tick & (SLOTS-1)];
+	if (slot.empty()) return;
 
-	net.active_vehicles++;
-	if (!veh->update(person.trip->path, app, net, met, dt))
-		return; // trip ongoing
+	// slot order depends on cascading, wake in schedule order instead
+	std::sort(slot.begin(), slot.end(), [] (Entry const& l, Entry const& r) { return l.order < r.order; });
+	for (auto& e : slot) {
+		assert(e.due == tick);
+		woken.push_back(e.person);
+	}
+	count -= (int)slot.size();
+	slot.clear();
+}
+void PersonScheduler::update (float dt, std::vector<int>& woken) {
+	time += (double)dt;
 
-	person.trip->finish_trip(person);
-	person.stay_timer = net._stay_time;
+	uint64_t last_tick = (uint64_t)floor(time / (double)TICK);
+	for (; cur_tick <= last_tick; ++cur_tick) {
+		_process_tick(cur_tick, woken);
+	}
+}
+void PersonScheduler::clear () {
+	for (auto& level : wheels)
+		for (auto& slot : level)
+			slot.clear();
+	overflow.clear();
+	count = 0;
 }
 
-void Network::simulate (App& app) {
+void SimThreads::for_chunks (int num_threads, int count, ChunkFunc const& func) {
+	int chunks = num_chunks(count);
+
+	if (num_threads <= 1 || chunks <= 1) {
+		for (int chunk=0; chunk<chunks; ++chunk)
+			func(chunk, chunk*CHUNK_SIZE, min((chunk+1)*CHUNK_SIZE, count));
+		return;
+	}
+
+	if (!threadpool || _num_threads != num_threads) {
+		threadpool = nullptr; // join old threads first
+		threadpool = std::make_unique<Threadpool<Job>>(num_threads, TPRIO_PARALLELISM, "sim threads");
+		_num_threads = num_threads;
+	}
+
+	std::vector<std::unique_ptr<Job>> jobs(chunks);
+	for (int chunk=0; chunk<chunks; ++chunk)
+		jobs[chunk] = std::make_unique<Job>(Job{ &func, chunk, chunk*CHUNK_SIZE, min((chunk+1)*CHUNK_SIZE, count) });
+
+	threadpool->jobs.push_n(jobs.data(), jobs.size());
+
+	for (int i=0; i<chunks; ++i)
+		threadpool->results.pop_wait();
+}
+
+void Network::tick (World& app, float dt) {
 	ZoneScoped;
 
-	pathing_count = 0;
-	active_vehicles = 0;
+	Metrics::Var met;
 
-	float dt = app.sim_dt();
+	int num_threads = sim_thread_count();
 
-	// to avoid debugging overlays only showing while not paused, only skip moving the car when paused, later actually skip sim steps
-	bool force_update_for_dbg = true;
-	if (dt > 0.0f || force_update_for_dbg) {
-		Metrics::Var met;
-		
-		{ // TODO: only iterate active vehicles
-			ZoneScopedN("init pass");
-			for (auto& pers : app.entities.persons) {
-				//if (pers->cur_building) continue;
-				
-				auto* veh = pers->owned_vehicle.get();
-				assert(veh);
-				if (veh->sim)
-					veh->begin_update();
+	auto lap_time = std::chrono::steady_clock::now();
+	auto lap = [&] () {
+		auto now = std::chrono::steady_clock::now();
+		float elapsed = std::chrono::duration<float>(now - lap_time).count();
+		lap_time = now;
+		return elapsed;
+	};
+	
+	{
+		ZoneScopedN("init pass");
+		vehicle_states.begin_update();
+	}
+	_last_timings.init = lap();
+	
+	{
+		ZoneScopedN("update segments");
+		// segments only write their own lanes and the vehicles on them
+		sim_threads.for_chunks(num_threads, (int)segments.size(), [&] (int chunk, int i0, int i1) {
+			ZoneScopedN("update segments chunk");
+			for (int i=i0; i<i1; ++i) {
+				update_segment(app, segments[i].get());
 			}
+		});
+	}
+	_last_timings.segments = lap();
+	{
+		ZoneScopedN("update nodes");
+		// nodes write outgoing lanes and brake vehicles on adjacent segments, so only non-adjacent nodes run in parallel
+		for (auto& color : _node_colors) {
+			sim_threads.for_chunks(num_threads, (int)color.size(), [&] (int chunk, int i0, int i1) {
+				ZoneScopedN("update nodes chunk");
+				for (int i=i0; i<i1; ++i) {
+					update_node(app, color[i], dt);
+				}
+			});
 		}
-		
-		{
-			ZoneScopedN("update segments");
-			for (auto& seg : segments) {
-				update_segment(app, seg.get());
+
+		// vehicles forget the nodes that dropped them, serially since one vehicle can be dropped by several nodes of a color
+		for (auto& node : nodes) {
+			for (auto* veh : node->vehicles.dropped) {
+				auto& sim = *veh->sim;
+				if (sim.tracking_node == node.get())
+					sim.tracking_node = nullptr;
+				else
+					std::erase(sim.prev_tracking_nodes, node.get());
 			}
+			node->vehicles.dropped.clear();
 		}
-		{
-			ZoneScopedN("update nodes");
-			for (auto& node : nodes) {
-				update_node(app, node.get(), dt);
-			}
+	}
+	_last_timings.nodes = lap();
+	
+	{
+		ZoneScopedN("final pass");
+		// vehicles move between lanes, brake each other while merging and request trips here, which depends on order
+
+		// persons whose stay is over request their next trip
+		// due persons are woken as a batch, which is dispatched to pathfinding together at the end of the tick
+		_woken_persons.clear();
+		person_scheduler.update(dt, _woken_persons);
+		for (int id : _woken_persons) {
+			if (id >= (int)app.entities.persons.size()) continue;
+			auto& person = *app.entities.persons[id];
+			// don't request a trip twice if the person was scheduled again or already left
+			if (!person.cur_building || person.trip || person.trip_requested) continue;
+			PersonTrip::request_trip(person, *this, app.entities, app.sim_rand);
 		}
-		
-		{
-			ZoneScopedN("final pass");
-			for (auto& person : app.entities.persons) {
-				person->trip->update(app, *person, app.network, app.entities, met, app.sim_rand, dt);
+
+		for (int i=0; i<(int)active_persons.size(); ) {
+			auto* person = active_persons[i];
+			PersonTrip::update_vehicle(app, *person, *this, dt);
+
+			// finished trips get swap-removed, update the person moved into this slot next
+			if (person->_active_idx == i) i++;
+		}
+	}
+	_last_timings.final_pass = lap();
+	{
+		ZoneScopedN("animation pass");
+		// per-chunk metrics, summed in chunk order to be independent of thread count
+		std::vector<Metrics::Var> chunk_met(SimThreads::num_chunks((int)active_persons.size()));
+
+		sim_threads.for_chunks(num_threads, (int)active_persons.size(), [&] (int chunk, int i0, int i1) {
+			ZoneScopedN("animation pass chunk");
+			auto& met = chunk_met[chunk];
+
+			for (int i=i0; i<i1; ++i) {
+				auto* veh = active_persons[i]->owned_vehicle.get();
+
+				if (veh->sim->flow) {
+					met.total_flow += *veh->sim->flow;
+					met.total_flow_weight += 1;
+					veh->sim->flow = {};
+				}
+				if (veh->sim->anim_step) {
+					auto& step = *veh->sim->anim_step;
+
+					if (dt > 0) { // keep interpolating to the same positions while paused
+						veh->sim->prev_front_pos = veh->sim->front_pos;
+						veh->sim->prev_rear_pos  = veh->sim->rear_pos;
+					}
+					vehicle_update_animation(*veh, *this, step.front, step.turn_curv, step.delta_dist, dt);
+					veh->sim->anim_step = {};
+				}
 			}
+		});
+
+		for (auto& m : chunk_met) {
+			met.total_flow += m.total_flow;
+			met.total_flow_weight += m.total_flow_weight;
+		}
+	}
+	_last_timings.animation = lap();
+	
+	// the zero timestep tick while paused only refreshes overlays, beginning trips or dispatching here would make results depend on pausing
+	if (dt > 0) {
+		ZoneScopedN("begin trips");
+		// begin trips pathfound since last tick, then kick off pathfinding for this tick's requests
+		// dispatched per tick so results don't depend on framerate, the async batch of the last tick of a frame is solved while rendering
+		pathfind_queue.apply_results(app, *this);
+
+		// no pathfinding running at this point, so the graph and hierarchy can safely be swapped
+		if (graph.avoid_traffic_lights != settings.pathfinding.avoid_traffic_lights) {
+			path_cache.clear(); // costs changed everywhere
+			rebuild_graph();
+		}
+		else if (_graph_dirty) {
+			rebuild_graph();
+		}
+		path_cache.shrink(settings.pathfinding.path_cache_size);
+
+		if (settings.pathfinding.contraction_hierarchy)
+			ch.update(*this);
+
+		// sliced requests are queued once per frame in simulate() instead, since their budget is per frame
+		if (!pathfind_sliced())
+			pathfind_queue.dispatch(settings.pathfinding.async, false);
+	}
+	_last_timings.pathfinding = lap();
+
+	_sim_time += dt;
+
+	metrics.update(met);
+}
+
+void Network::hash_state (StateHash& state) {
+	ZoneScoped;
+	
+	state.entities.clear();
+	StateHash::Hasher total;
+
+	auto add_entity = [&] (StateHash::EntityType type, int id, StateHash::Hasher& h) {
+		state.entities.push_back({ type, id, h.h });
+		total.add((uint64_t)type);
+		total.add(id);
+		total.add(h.h);
+	};
+	auto add_lane = [] (StateHash::Hasher& h, SegLane const& lane) {
+		h.add(lane.seg ? lane.seg->_id : -1);
+		h.add((int)lane.lane);
+	};
+
+	// in update order, since that affects results as well
+	for (auto* person : active_persons) {
+		auto& sim = *person->owned_vehicle->sim;
+		StateHash::Hasher h;
+		h.add(sim.id);
+		h.add(sim.mot.idx);
+		h.add((int)sim.mot.motion);
+		h.add(sim.mot.end_t);
+		h.add(sim.mot.next_start_t);
+		add_lane(h, sim.mot.cur_lane);
+		add_lane(h, sim.mot.next_lane);
+		h.add(sim.mot_t());
+		h.add(sim.speed());
+		h.add(sim.bez_speed());
+		add_entity(StateHash::VEHICLE, person->_id, h);
+	}
+
+	for (auto& seg : segments) {
+		StateHash::Hasher h;
+		for (auto& lane : seg->vehicles.lanes) {
+			h.add(lane.count);
+			for (auto* veh : lane)
+				h.add(veh->sim->id);
+		}
+		add_entity(StateHash::SEGMENT, seg->_id, h);
+	}
+
+	for (auto& node : nodes) {
+		StateHash::Hasher h;
+		for (auto& v : node->vehicles.test.list) {
+			h.add(v.veh->sim->id);
+			h.add((int)v.blocked);
 		}
+		add_entity(StateHash::NODE, node->_id, h);
+	}
+
+	state.total = total.h;
+}
+
+void Network::simulate (World& app, float frame_dt) {
+	ZoneScoped;
 
-		metrics.update(met);
+	pathing_count = 0;
+	pathfind_queue.reset_frame_stats();
+
+	float tick_dt = settings.tick_dt;
+
+	lod_focus = app._view.cam_pos;
+
+	_sim_accum += frame_dt;
+	int substeps = floori(_sim_accum / tick_dt);
+	_sim_accum -= (float)substeps * tick_dt;
+
+	if (substeps > settings.max_substeps) {
+		// can't keep up, drop the remaining time so sim runs slower instead of needing even more ticks next frame
+		substeps = settings.max_substeps;
+		_sim_accum = 0;
+	}
+
+	for (int i=0; i<substeps; ++i) {
+		tick(app, tick_dt);
 	}
 
+	// to avoid debugging overlays only showing while not paused, still update with zero timestep while paused
+	// only while paused, so results don't depend on framerate
+	if (substeps == 0 && frame_dt == 0.0f) {
+		tick(app, 0);
+	}
+
+	// sliced pathfinding gets its budget once per frame, regardless of substeps, and does not progress while paused
+	// results are applied in the next tick
+	if (frame_dt > 0.0f) {
+		if (pathfind_sliced())
+			pathfind_queue.dispatch(false, true);
+		pathfind_queue.update_sliced(*this);
+	}
+
+	_interp_t = clamp(_sim_accum / tick_dt, 0.0f, 1.0f);
+	_last_substeps = substeps;
+
 	static RunningAverage pathings_avg(30);
 	pathings_avg.push((float)pathing_count);
 	float min, max;
 	float avg = pathings_avg.calc_avg(&min, &max);
 	ImGui::Text("pathing_count: avg %3.1f min: %3.1f max: %3.1f", avg, min, max);
+	ImGui::Text("substeps: %d", _last_substeps);
+
+	static RunningAverage latency_avg(30);
+	latency_avg.push(pathfind_queue._last_latency * 1000);
+	avg = latency_avg.calc_avg(&min, &max);
+	ImGui::Text("pathfind queue: last frame %3d latency avg %5.2fms max %5.2fms avg iter %5.0f",
+		pathfind_queue._last_count, avg, max, pathfind_queue.last_avg_iter());
+	ImGui::Text("sliced pathfinding: pending %3d last frame iter %6d time %5.2fms",
+		(int)pathfind_queue.pending.size(), pathfind_queue._last_sliced_iter, pathfind_queue._last_sliced_time * 1000);
+	path_cache.imgui();
 	
 
 	ImGui::Text("nodes: %05d segments: %05d persons: %05d",
 		(int)nodes.size(), (int)segments.size(), (int)app.entities.persons.size());
 	
-	ImGui::Text("last dijkstra: iter: %05d iter_dupl: %05d iter_lanes: %05d", _dijk_iter, _dijk_iter_dupl, _dijk_iter_lanes);
+	ImGui::Text("last %s: iter: %05d decreases: %05d max_queue: %05d iter_edges: %05d", pathfind_ctx._algorithm,
+		pathfind_ctx._iter, pathfind_ctx._decreases, pathfind_ctx._max_queue, pathfind_ctx._iter_edges);
 
 }
 
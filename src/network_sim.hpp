@@ -2,8 +2,15 @@
 #include "common.hpp"
 #include "network.hpp"
 #include "interact.hpp"
+#include "turn_graph.hpp"
+#include "contraction_hierarchy.hpp"
+#include "engine/kisslib/threadpool.hpp"
+#include <chrono>
+#include <list>
+#include <deque>
+#include <functional>
 
-class App;
+class World;
 
 namespace network {
 class Network;
@@ -69,6 +76,105 @@ inline ParkingSpot* find_parking_near (Building* dest) {
 	return find_street_parking(dest->connected_segment);
 }
 
+// Scratch state of a pathfinding query, stored outside of the network so multiple queries can run at the same time
+// Indexed by TurnGraph vertex, reused for every query of one thread
+// Instead of resetting all vertices for every query, states are lazily reset on access by comparing their generation
+struct PathfindContext {
+	struct VertexState {
+		uint32_t gen;
+
+		float    cost;
+		float    key; // cost + heuristic, priority in queue
+		uint32_t qkey; // quantized key for radix heap
+		bool     visited;
+		bool     from_start; // pred is the start segment, path ends there
+		int      q_idx; // index in heap (or radix heap bucket), -1 if not queued
+
+		int      pred; // previous vertex
+	};
+
+	std::vector<VertexState> vertices;
+	uint32_t cur_gen = 0;
+
+	// priority queue storage, kept around to avoid allocations
+	std::vector<int> heap;
+	std::vector<int> radix_buckets[33];
+	uint32_t radix_last = 0;
+
+	static constexpr float RADIX_KEY_SCALE = 1000.0f; // costs are in seconds, quantize to ms
+
+	// for contraction hierarchy queries
+	ContractionHierarchy::QueryContext ch;
+
+	// stats of last query
+	int  _iter = 0;
+	int  _decreases = 0;
+	int  _max_queue = 0;
+	int  _iter_edges = 0;
+	const char* _algorithm = "dijkstra";
+
+	void begin_query (int num_vertices) {
+		if ((int)vertices.size() != num_vertices) {
+			vertices.assign(num_vertices, VertexState{ 0 });
+			cur_gen = 0;
+		}
+
+		cur_gen++;
+		if (cur_gen == 0) { // wrapped around, need actual reset once
+			for (auto& v : vertices) v.gen = 0;
+			cur_gen = 1;
+		}
+	}
+
+	VertexState& operator[] (int vertex) {
+		assert(vertex >= 0 && vertex < (int)vertices.size());
+		auto& v = vertices[vertex];
+		if (v.gen != cur_gen) {
+			v = { cur_gen, INF, INF, 0, false, false, -1, -1 };
+		}
+		return v;
+	}
+	// for visualization, null if vertex was not touched by last query
+	VertexState const* try_get (int vertex) const {
+		if (vertex < 0 || vertex >= (int)vertices.size()) return nullptr;
+		auto& v = vertices[vertex];
+		return v.gen == cur_gen ? &v : nullptr;
+	}
+
+	void mem_use (MemUse& mem) {
+		mem.add("PathfindContext::vertices", MemUse::sizeof_alloc(vertices));
+		size_t queue = MemUse::sizeof_alloc(heap);
+		for (auto& b : radix_buckets) queue += MemUse::sizeof_alloc(b);
+		mem.add("PathfindContext::queue", queue);
+		ch.mem_use(mem);
+	}
+};
+
+// Immutable segment sequence found by pathfinding, shared between Paths and the PathCache instead of copied
+class PathSegments {
+	std::shared_ptr<const std::vector<Segment*>> segs = nullptr;
+public:
+	PathSegments () {}
+	explicit PathSegments (std::vector<Segment*>&& segments):
+		segs{ std::make_shared<const std::vector<Segment*>>(std::move(segments)) } {}
+
+	int size () const { return segs ? (int)segs->size() : 0; }
+	bool empty () const { return size() == 0; }
+
+	Segment* operator[] (int i) const {
+		assert(segs && i >= 0 && i < (int)segs->size());
+		return (*segs)[i];
+	}
+
+	auto begin () const { return segs ? segs->data() : nullptr; }
+	auto end () const { return segs ? segs->data() + segs->size() : nullptr; }
+
+	// number of Paths/caches referencing this sequence
+	int use_count () const { return (int)segs.use_count(); }
+
+	size_t sizeof_alloc () const { return segs ? sizeof(*segs) + MemUse::sizeof_alloc(*segs) : 0; }
+};
+
 // Stores the path from pathfinding
 // Is a Sequence of Motions that a vehicle performs to drive along a path acting as a state machine
 // step() should be called whenever the vehicle has performed the Motion represented by the current Motion
@@ -122,7 +228,8 @@ public:
 
 	void mem_use (MemUse& mem) {
 		mem.add("Path", sizeof(*this));
-		for (auto& i : path) mem.add("Path::path[]", sizeof(i));
+		// shared segments are counted by PathCache
+		if (path.use_count() == 1) mem.add("Path::path[]", path.sizeof_alloc());
 	}
 	
 	// Make Endpoint/EndCurve a seperate class that handles everything including Pathfinding forw/backw flags?
@@ -233,7 +340,10 @@ public:
 	Endpoint start;
 	Endpoint dest;
 
-	std::vector<Segment*> path;
+	PathSegments path;
+
+	// seeds lane selection in get_motion, derived from ids instead of addresses so runs are reproducible
+	uint64_t seed = 0;
 
 	// start and destination getters implemented by Trip
 	Endpoint::Curve get_trip_start (SegLane lane) {
@@ -252,18 +362,7 @@ public:
 		return Endpoint::Curve::calc(dest, {lane, true});
 	}
 	
-	// HACK: to fix problem with node vehicle tracking
-	void _clear_nodes (Vehicle& veh) {
-		int num_seg = (int)path.size();
-		
-		for (int i=0; i<num_seg-1; ++i) {
-			auto* node = Node::between(path[i], path[i+1]);
-			node->vehicles.test.try_remove(&veh);
-		}
-	}
 	void _dtor (Vehicle& veh) {
-		_clear_nodes(veh);
-
 		// need to unreserve if deleted vehicle with trip etc.
 		if (dest.parking && dest.parking->reserved)
 			dest.parking->unreserve(&veh);
@@ -274,9 +373,8 @@ public:
 		// Able to pathfind while restricting the starting directions for example for repathing
 		bool forw = true, backw = true;
 	};
-	static bool pathfind (Network& net, PathEnd start, PathEnd dest, std::vector<Segment*>* result_path);
+	static bool pathfind (Network& net, PathfindContext& ctx, PathEnd start, PathEnd dest, std::vector<Segment*>* result_path);
 	
-	static std::optional<Path> begin (Network& net, Endpoint start, Endpoint dest);
 	bool repath (Network& net, Endpoint new_dest, Vehicle& veh);
 	
 	void visualize (OverlayDraw& overlay, Network& net, Vehicle& veh, bool skip_next_node, lrgba col=lrgba(1,1,0,0.75f));
@@ -292,6 +390,70 @@ public:
 	void finish_vehicle_trip (Vehicle& veh);
 };
 
+// Hot simulation state of all simulated vehicles as structure of arrays, indexed by SimVehicle::id
+// These are touched by segment, node and vehicle logic every tick, so they are kept densely packed
+//  instead of in the individually allocated SimVehicles, which also lets whole-array passes vectorize
+// ids are stable while the SimVehicle is simulated and get reused afterwards
+class SimVehicleStates {
+public:
+	// [0,1] bezier parameter for current segment/node curve
+	// or parking/unparking startup timer
+	std::vector<float> mot_t;
+
+	std::vector<float> brake; // set by controlled conflict logic, to brake smoothly
+	std::vector<float> speed; // worldspace speed controlled by acceleration and brake
+
+	// speed (delta position) / delta beizer t
+	// INF to force no movement on initial tick (rather than div by 0)
+	// set after timestep based on current bezier eval, to approx correct worldspace step size along bezier in next tick
+	std::vector<float> bez_speed;
+
+	std::vector<int> free_ids;
+
+	int alloc () {
+		int id;
+		if (!free_ids.empty()) {
+			id = free_ids.back();
+			free_ids.pop_back();
+		}
+		else {
+			id = (int)mot_t.size();
+			mot_t    .emplace_back();
+			brake    .emplace_back();
+			speed    .emplace_back();
+			bez_speed.emplace_back();
+		}
+
+		mot_t    [id] = 0;
+		brake    [id] = 1;
+		speed    [id] = 0;
+		bez_speed[id] = INF;
+		return id;
+	}
+	void free (int id) {
+		assert(id >= 0 && id < (int)mot_t.size());
+		free_ids.push_back(id);
+	}
+	// all SimVehicles must be gone
+	void clear () {
+		mot_t    .clear();
+		brake    .clear();
+		speed    .clear();
+		bez_speed.clear();
+		free_ids .clear();
+	}
+
+	// reset brakes before conflict logic runs (free ids included, which is harmless)
+	void begin_update () {
+		std::fill(brake.begin(), brake.end(), 1.0f);
+	}
+
+	void mem_use (MemUse& mem) {
+		mem.add("SimVehicleStates", MemUse::sizeof_alloc(mot_t) + MemUse::sizeof_alloc(brake) +
+			MemUse::sizeof_alloc(speed) + MemUse::sizeof_alloc(bez_speed) + MemUse::sizeof_alloc(free_ids));
+	}
+};
+
 class SimVehicle {
 public:
 	void mem_use (MemUse& mem) {
@@ -303,40 +465,96 @@ public:
 	Path* path; // TODO: could potentially eliminated
 
 	Path::Motion mot;
-	
-	// [0,1] bezier parameter for current segment/node curve
-	// or parking/unparking startup timer
-	float mot_t = 0;
 
-	float brake = 1; // set by controlled conflict logic, to brake smoothly
-	float speed = 0; // worldspace speed controlled by acceleration and brake
+	// hot state in SimVehicleStates, only while simulated (not for preview vehicles)
+	SimVehicleStates* states = nullptr;
+	int id = -1;
+
+	float& mot_t     () { return states->mot_t    [id]; }
+	float& brake     () { return states->brake    [id]; }
+	float& speed     () { return states->speed    [id]; }
+	float& bez_speed () { return states->bez_speed[id]; }
+
+	// links in LaneVehicles of mot.cur_vehicles, lane_prev is the vehicle in front (the leader)
+	Vehicle* lane_prev = nullptr;
+	Vehicle* lane_next = nullptr;
+
+	// node tracking this vehicle in NodeVehicles (the one it is approaching or in)
+	// and the previous ones, which keep tracking it until it is clear of them (can be several for vehicles longer than segments)
+	// only written by update_node of the approaching node, neighbouring nodes never update concurrently
+	// nodes that drop the vehicle are cleared from these after the node pass (serially, a long vehicle can be dropped by several nodes of one color)
+	// so these are exactly the nodes whose NodeVehicles contain the vehicle
+	Node* tracking_node = nullptr;
+	std::vector<Node*> prev_tracking_nodes;
+
+	// simulated as queue in lane instead of full model, see Settings::MesoLOD
+	// only switched while in a lane (update_lane_lod), stays the same while crossing nodes
+	bool meso = false;
+	// mesoscopic vehicle waiting in the lane queue (once clear of all nodes), not stepped or positioned at all
+	// until it is at the front of the lane and meso_exit_time (Network::_sim_time) passed, or it gets promoted
+	// mot_t, bez_speed and positions stay those of when it was queued
+	bool meso_queued = false;
+	float meso_enter_t;
+	double meso_enter_time;
+	double meso_exit_time;
+
+	// estimated mot_t while queued, moves from where it was queued to the lane end until its exit time
+	float meso_est_t (double time) {
+		float progress = meso_exit_time > meso_enter_time ? (float)((time - meso_enter_time) / (meso_exit_time - meso_enter_time)) : 1.0f;
+		return lerp(meso_enter_t, mot.end_t, clamp(progress, 0.0f, 1.0f));
+	}
 
-	// speed (delta position) / delta beizer t
-	// INF to force no movement on initial tick (rather than div by 0)
-	// set after timestep based on current bezier eval, to approx correct worldspace step size along bezier in next tick
-	float bez_speed = INF;
+	// stopped in lane with brake 0 (behind stopped leader, red light or full lane), skips speed update, bezier eval
+	// and animation until its brake is nonzero again, which the segment and node passes still compute every tick
+	bool sleeping = false;
 
 //// Movement sim variables for visuals
 	float3 front_pos; // car front
 	float3 rear_pos; // car rear
-
-	// another velocity parameter, this time for the center of the car, to implement suspension
-	// TODO: this should not exist, OR be the only velocity paramter
-	float3 center_vel = 0;
-	// suspension (ie. car wobble) angles based on car acceleration on forward and sideways axes (computed seperately)
-	float3 suspension_ang = 0; // angle in radians, X: sideways (rotation on local X), Y: forwards
-	float3 suspension_ang_vel = 0; // angular velocity in radians
+	// positions before last tick, rendering interpolates towards front_pos and rear_pos
+	float3 prev_front_pos;
+	float3 prev_rear_pos;
+
+	// Visual only state that drives the bone matrices in rendering, not part of the simulation
+	// only animated while visible (ObjectRender::upload_vehicle_instances tests the view frustum each frame)
+	// and re-seeded from the current pose once the vehicle becomes visible again
+	struct Visuals {
+		bool visible = false; // in view frustum (plus margin) last frame
+		bool valid = false; // false -> state below is stale, rendered without bone animation
+
+		// another velocity parameter, this time for the center of the car, to implement suspension
+		// TODO: this should not exist, OR be the only velocity paramter
+		float3 center_vel = 0;
+		// suspension (ie. car wobble) angles based on car acceleration on forward and sideways axes (computed seperately)
+		float3 suspension_ang = 0; // angle in radians, X: sideways (rotation on local X), Y: forwards
+		float3 suspension_ang_vel = 0; // angular velocity in radians
 	
-	// curvature, ie. 1/turn_radius, positive means left
-	float turn_curv = 0;
-	float wheel_roll = 0;
+		// curvature, ie. 1/turn_radius, positive means left
+		float turn_curv = 0;
+		float wheel_roll = 0;
+	} vis;
 
 	float blinker = 0;
 	float blinker_timer = 0; // could get eliminated (a fixed number of blinker timers indexed using vehicle id hash)
 	float brake_light = 0;
 
+	// Movement of this tick, visuals are updated from this after all vehicles moved
+	// only touches this vehicle, so Network::simulate can do it in parallel
+	struct AnimStep {
+		float3 front;
+		float turn_curv;
+		float delta_dist;
+	};
+	std::optional<AnimStep> anim_step;
+	// speed / speed limit of this tick for Metrics, only while driving
+	std::optional<float> flow;
+
 	void _dtor (Vehicle& veh) {
-		if (mot.cur_vehicles) mot.cur_vehicles->list.try_remove(&veh);
+		if (mot.cur_vehicles) mot.cur_vehicles->try_remove(&veh);
+		if (tracking_node) tracking_node->vehicles.test.try_remove(&veh);
+		for (auto* node : prev_tracking_nodes)
+			node->vehicles.test.try_remove(&veh);
+		if (states) states->free(id);
 	}
 	
 	static PosRot get_init_pos (Bezier3 const& bez, VehicleAsset* asset) {
@@ -352,6 +570,9 @@ public:
 	void init_pos (PosRot pos, VehicleAsset* asset) {
 		front_pos = pos.pos;
 		rear_pos = pos.pos - (rotate3_Z(pos.ang) * float3(1,0,0)) * asset->length();
+		// teleport, don't interpolate
+		prev_front_pos = front_pos;
+		prev_rear_pos  = rear_pos;
 	}
 
 	float3 _center () { return (front_pos + rear_pos)*0.5; };
@@ -360,6 +581,13 @@ public:
 		float ang = angle2d((float2)front_pos - (float2)rear_pos);
 		return PosRot{ _center(), ang };
 	}
+	// position between last and current tick for rendering, see Network::_interp_t
+	PosRot calc_render_pos (float interp_t) {
+		float3 front = lerp(prev_front_pos, front_pos, interp_t);
+		float3 rear  = lerp(prev_rear_pos,  rear_pos,  interp_t);
+		float ang = angle2d((float2)front - (float2)rear);
+		return PosRot{ (front + rear)*0.5f, ang };
+	}
 	
 	bool update_blinker (float rand_num, float dt) {
 		constexpr float blinker_freq_min = 1.6f;
@@ -409,10 +637,7 @@ public:
 		return {};
 	}
 	
-	void begin_update () {
-		sim->brake = 1;
-	}
-	bool update (Path& path, App& app, Network& net, Metrics::Var& met, float dt);
+	bool update (Path& path, World& app, Network& net, float dt);
 
 
 	Vehicle (IVehicleOwner* owner, VehicleAsset* asset, lrgb tint_col, float agressiveness):
@@ -481,6 +706,11 @@ public:
 	}
 };
 
+inline LaneVehicles::Iterator& LaneVehicles::Iterator::operator++ () {
+	cur = cur->sim->lane_next;
+	return *this;
+}
+
 class PersonTrip {
 public:
 	void mem_use (MemUse& mem) {
@@ -490,12 +720,360 @@ public:
 	
 	Path path;
 	
-	static bool begin_trip (Person& person, Network& net, Entities& entities, Random& rand);
+	// pick destination and queue pathfinding, trip begins once Network applies the result
+	static void request_trip (Person& person, Network& net, Entities& entities, Random& rand);
+	static void begin_trip (Person& person, Network& net, Building* dest_building, PathSegments const& segments);
+
+	void cancel_trip (Person& person, Network& net);
+	void finish_trip (Person& person, Network& net);
+
+	static void update_vehicle (World& app, Person& person, Network& net, float dt);
+};
+
+// Graph search (dijkstra or A*) on the network TurnGraph that can be suspended and resumed,
+//  to spread long queries over multiple frames
+// All search state lives in the PathfindContext, so the context can't be used for other queries until this one is finished
+class PathfindQuery {
+	struct GetKey {
+		PathfindContext* ctx;
+		float operator() (int const& v) const { return ctx->vertices[v].key; }
+	};
+	struct GetQKey {
+		PathfindContext* ctx;
+		uint32_t operator() (int const& v) const { return ctx->vertices[v].qkey; }
+	};
+	struct GetIdx {
+		PathfindContext* ctx;
+		int& operator() (int& v) const { return ctx->vertices[v].q_idx; }
+	};
+
+	MinHeapFunc<int, GetKey, GetIdx> heap () {
+		return { ctx->heap, { ctx }, { ctx } };
+	}
+	RadixHeapFunc<int, GetQKey, GetIdx> radix_heap () {
+		return { ctx->radix_buckets, ctx->radix_last, { ctx }, { ctx } };
+	}
+
+	Network* net = nullptr;
+	PathfindContext* ctx = nullptr;
+	Path::PathEnd dest;
 
-	void cancel_trip (Person& person);
-	void finish_trip (Person& person);
+	bool  astar;
+	bool  use_radix;
+	float inv_max_speed;
+	int   dest_forw, dest_backw;
 
-	static void update (App& app, Person& person, Network& net, Entities& entities, Metrics::Var& met, Random& rand, float dt);
+	int queue_size = 0;
+	int end_vertex = -1;
+
+	float heuristic (int vertex);
+	void relax_edges (int vertex, float cost, bool from_start);
+
+public:
+	bool finished = true;
+	int graph_version = -1; // query needs to be restarted if graph was rebuilt since begin
+
+	void begin (Network& net, PathfindContext& ctx, Path::PathEnd start, Path::PathEnd dest, bool astar);
+	// visit up to max_iter vertices, returns true once finished
+	bool step (int max_iter);
+	// false if no path was found
+	bool get_result (std::vector<Segment*>* result_path);
+};
+
+struct PathCacheKey {
+	Segment* start;
+	Segment* dest;
+	bool forw, backw; // allowed start directions
+
+	bool operator== (PathCacheKey const& other) const {
+		return start == other.start && dest == other.dest && forw == other.forw && backw == other.backw;
+	}
+	bool operator!= (PathCacheKey const& other) const {
+		return !(*this == other);
+	}
+};
+VALUE_HASHER(PathCacheKey, t.start, t.dest, t.forw, t.backw);
+
+// LRU cache of pathfinding results, since many persons travel between the same few buildings
+// Only accessed on the main thread, lookups happen when trips are requested, inserts when results are applied
+// Entries are invalidated when the network changes around them, while Paths already using the segments keep them alive
+class PathCache {
+	struct Entry {
+		PathCacheKey key;
+		PathSegments path;
+	};
+	// most recently used first
+	std::list<Entry> lru;
+	Hashmap<PathCacheKey, std::list<Entry>::iterator, PathCacheKeyHasher> map;
+
+public:
+	// stats since last reset
+	int _hits = 0;
+	int _misses = 0;
+	int _invalidated = 0;
+
+	// incremented on every invalidation, results of queries started before that might use stale paths and must not be inserted
+	int epoch = 0;
+
+	int size () const { return (int)map.size(); }
+
+	static PathCacheKey key (Path::PathEnd start, Path::PathEnd dest) {
+		return { start.seg, dest.seg, start.forw, start.backw };
+	}
+
+	// returns empty sequence on miss
+	PathSegments find (Path::PathEnd start, Path::PathEnd dest) {
+		auto* it = map.try_get(key(start, dest));
+		if (!it) {
+			_misses++;
+			return {};
+		}
+
+		_hits++;
+		lru.splice(lru.begin(), lru, *it);
+		return (*it)->path;
+	}
+
+	void insert (Path::PathEnd start, Path::PathEnd dest, PathSegments const& path, int capacity) {
+		auto k = key(start, dest);
+		if (capacity <= 0 || map.try_get(k)) return;
+
+		lru.push_front({ k, path });
+		map.add(k, lru.begin());
+
+		shrink(capacity);
+	}
+	// evict least recently used entries
+	void shrink (int capacity) {
+		while ((int)map.size() > max(capacity, 0)) {
+			map.erase(lru.back().key);
+			lru.pop_back();
+		}
+	}
+
+	// drop all paths through node, for changes that only affect one node (like traffic lights)
+	void invalidate (Node* node) {
+		invalidate_if([&] (PathSegments const& path) {
+			for (int i=0; i<path.size()-1; ++i) {
+				if (Node::between(path[i], path[i+1]) == node)
+					return true;
+			}
+			return false;
+		});
+	}
+	// drop all paths using segment
+	void invalidate (Segment* seg) {
+		invalidate_if([&] (PathSegments const& path) {
+			for (auto* s : path) {
+				if (s == seg) return true;
+			}
+			return false;
+		});
+	}
+	template <typename FUNC>
+	void invalidate_if (FUNC pred) {
+		epoch++;
+		for (auto it = lru.begin(); it != lru.end(); ) {
+			if (pred(it->path)) {
+				map.erase(it->key);
+				it = lru.erase(it);
+				_invalidated++;
+			}
+			else {
+				++it;
+			}
+		}
+	}
+
+	// segment pointers might be dangling after network rebuild
+	void clear () {
+		epoch++;
+		_invalidated += (int)map.size();
+		lru.clear();
+		map.clear();
+	}
+	void reset_stats () {
+		_hits = 0;
+		_misses = 0;
+		_invalidated = 0;
+	}
+
+	void imgui () {
+		int total = _hits + _misses;
+		ImGui::Text("path cache: entries %5d hits %6d misses %6d (hit rate %5.1f%%) invalidated %5d",
+			size(), _hits, _misses, total > 0 ? (float)_hits / (float)total * 100 : 0.0f, _invalidated);
+		ImGui::SameLine();
+		if (ImGui::SmallButton("reset##path_cache")) reset_stats();
+	}
+
+	void mem_use (MemUse& mem) {
+		mem.add("PathCache", MemUse::sizeof_alloc(map) + map.size() * (sizeof(Entry) + 2*sizeof(void*)));
+		size_t segs = 0;
+		for (auto& e : lru) segs += e.path.sizeof_alloc();
+		mem.add("PathCache::paths", segs);
+	}
+};
+
+// Pathfinding for trip starts, requests are queued during the sim tick and solved on a threadpool
+// Results are applied after the final pass of the next tick in request order,
+//  so the simulation outcome does not depend on thread count or timing
+// Without threadpool, requests can instead be solved on the main thread with a per-frame budget,
+//  long queries are suspended and resumed next frame, while the person keeps waiting in its building
+class PathfindQueue {
+public:
+	struct Job {
+		Network* net;
+		Person* person;
+		Building* dest_building;
+		Path::PathEnd start, dest;
+		int order;
+		bool started = false; // sliced query was begun
+
+		std::chrono::steady_clock::time_point dispatch_time;
+		int cache_epoch; // PathCache::epoch at dispatch
+
+		// results
+		bool success = false;
+		bool cached = false; // path was found in PathCache, not dispatched
+		PathSegments path;
+		int iter = 0;
+		std::chrono::steady_clock::time_point finish_time;
+
+		// run on threads
+		void execute ();
+	};
+	typedef std::vector<std::unique_ptr<Job>> Jobs;
+
+	// requested this tick, dispatched at end of tick
+	Jobs requests;
+	// dispatched last tick, in request order
+	Jobs dispatched;
+	int in_flight = 0;
+
+	// solved on main thread with per-frame budget, in request order, front is currently being solved by query
+	std::deque<std::unique_ptr<Job>> pending;
+	PathfindQuery query;
+	PathfindContext sliced_ctx;
+
+	static constexpr int SLICE_ITER = 64; // vertices visited between budget checks
+
+	// lazily created to keep Network movable
+	std::unique_ptr<Threadpool<Job>> threadpool = nullptr;
+
+	// stats of last frame, summed over all its ticks
+	int   _last_count = 0;
+	float _last_latency = 0; // max seconds from dispatch until result finished
+	int   _last_total_iter = 0;
+	int   _last_sliced_iter = 0; // vertices visited by sliced queries last frame
+	float _last_sliced_time = 0; // seconds
+
+	void reset_frame_stats () {
+		_last_count = 0;
+		_last_latency = 0;
+		_last_total_iter = 0;
+	}
+	float last_avg_iter () const {
+		return _last_count > 0 ? (float)_last_total_iter / (float)_last_count : 0;
+	}
+
+	void request (Network& net, Person& person, Building* dest_building, Path::PathEnd start, Path::PathEnd dest);
+
+	// start solving requests of this tick, on main thread if !async, with per-frame budget if sliced
+	// sliced requests are only queued here, call once per frame after the ticks (not per tick)
+	void dispatch (bool async, bool sliced);
+	// continue solving pending sliced requests until budget of this frame is used up, call once per frame
+	void update_sliced (Network& net);
+	// block until all dispatched jobs are finished
+	void wait ();
+	// begin trips in request order
+	void apply_results (World& app, Network& net);
+
+	// drop all requests and results, needed before persons, buildings or the network get destroyed
+	void clear ();
+
+	void mem_use (MemUse& mem) {
+		mem.add("PathfindQueue::Jobs", MemUse::sizeof_alloc(requests) + MemUse::sizeof_alloc(dispatched) + pending.size() * sizeof(void*));
+		sliced_ctx.mem_use(mem);
+		for (auto& j : dispatched) mem.add("PathfindQueue::Job", sizeof(*j) + (j->cached ? 0 : j->path.sizeof_alloc()));
+	}
+};
+
+// Hierarchical timer wheel waking persons staying in buildings once their stay is over,
+//  so only persons that are due get touched each tick
+// Sim time is quantized into ticks of TICK seconds, wheel level l has SLOTS slots of SLOTS^l ticks each,
+//  entries are cascaded into finer levels as their time approaches
+// Time only advances by sim dt, so pausing and game speed changes are handled naturally
+// Persons due in the same tick are woken in the order they were scheduled, to keep the simulation deterministic
+class PersonScheduler {
+public:
+	static constexpr float TICK = 1.0f / 16; // sim seconds
+	static constexpr int SLOT_BITS = 6;
+	static constexpr int SLOTS = 1 << SLOT_BITS;
+	static constexpr int LEVELS = 4; // SLOTS^LEVELS ticks = ~12 sim days, anything later waits in overflow
+
+	struct Entry {
+		uint64_t due; // tick
+		uint64_t order;
+		int      person; // Person::_id
+	};
+
+	std::vector<Entry> wheels[LEVELS][SLOTS];
+	std::vector<Entry> overflow;
+
+	double   time = 0; // sim seconds
+	uint64_t cur_tick = 0; // next tick to be processed
+	uint64_t next_order = 0;
+	int      count = 0;
+
+	void schedule (Person& person, float delay);
+
+	// advance time by dt and append persons that became due to woken, in tick and schedule order
+	void update (float dt, std::vector<int>& woken);
+
+	// drop all entries, needed before persons get destroyed
+	void clear ();
+
+	void _insert (Entry const& e);
+	void _process_tick (uint64_t tick, std::vector<int>& woken);
+
+	void mem_use (MemUse& mem) {
+		size_t sz = MemUse::sizeof_alloc(overflow);
+		for (auto& level : wheels)
+			for (auto& slot : level)
+				sz += MemUse::sizeof_alloc(slot);
+		mem.add("PersonScheduler", sz);
+	}
+};
+
+// Runs passes of Network::simulate on worker threads, split into chunks of fixed size
+// Chunks do not depend on the thread count, so per-chunk results can be reduced in chunk order
+//  and the simulation outcome is identical for any number of threads
+class SimThreads {
+public:
+	static constexpr int CHUNK_SIZE = 32;
+
+	typedef std::function<void(int chunk, int i0, int i1)> ChunkFunc;
+
+	struct Job {
+		ChunkFunc const* func;
+		int chunk, i0, i1;
+
+		// run on threads
+		void execute () {
+			(*func)(chunk, i0, i1);
+		}
+	};
+
+	// lazily created to keep Network movable, recreated if thread count setting changes
+	std::unique_ptr<Threadpool<Job>> threadpool = nullptr;
+	int _num_threads = 0;
+
+	static int num_chunks (int count) {
+		return (count + CHUNK_SIZE-1) / CHUNK_SIZE;
+	}
+
+	// call func for each chunk of [0, count) and block until all are done, on the calling thread if num_threads <= 1
+	void for_chunks (int num_threads, int count, ChunkFunc const& func);
 };
 
 class DebugVehicle : public Vehicle {
@@ -504,7 +1082,7 @@ friend class DebugVehicles;
 	Path path;
 
 	DebugVehicle (IVehicleOwner* owner, Assets& assets):
-		Vehicle{ Vehicle::create_random_vehicle(owner, assets, random) } {
+		Vehicle{ Vehicle::create_random_vehicle(owner, assets, kiss::random) } {
 
 	}
 };
@@ -520,7 +1098,7 @@ public:
 
 	DebugVehicles (): ExclusiveTool{"Debug Vehicles"} {}
 	
-	void remove_vehicle (Vehicle* vehicle) override {
+	void remove_vehicle (Network& net, Vehicle* vehicle) override {
 		remove_first(vehicles, vehicle, [] (std::unique_ptr<DebugVehicle> const& l, Vehicle* r) { return l.get() == r; });
 	}
 	
@@ -550,14 +1128,15 @@ public:
 
 		preview_veh = nullptr;
 
-		if (I.hover_pos) {
+		auto hover = I.hover_pos.get();
+		if (hover) {
 			// place at hover pos if anything hovered and make visible (preview_veh gets rendered)
 			
 			// recreate SimVehicle used to render vehicle at arbitrary position 
 			next_vehicle->sim = std::make_unique<SimVehicle>();
 			next_vehicle->sim->path = &next_vehicle->path;
 
-			next_vehicle->sim->init_pos(*I.hover_pos, next_vehicle->asset);
+			next_vehicle->sim->init_pos(*hover, next_vehicle->asset);
 
 			// show vehicle only when hover valid (but keep next_vehicle)
 			preview_veh = next_vehicle.get();
@@ -575,6 +1154,49 @@ public:
 	}
 };
 
+// Conflict zone of two connections through a node, from intersections of the edges of their lane corridors
+// vectorized if simd is available, check_conflict_scalar is the reference implementation with identical results
+Conflict check_conflict (CachedConnection const& a, CachedConnection const& b);
+Conflict check_conflict_scalar (CachedConnection const& a, CachedConnection const& b);
+
+// Hash of the sim state each tick, to prove optimizations don't change behavior (see headless.cpp record= and verify=)
+// Entities are identified by ids instead of addresses, so hashes of different runs are comparable
+struct StateHash {
+	enum EntityType : uint32_t {
+		VEHICLE=0, // id: Person::_id
+		SEGMENT,   // id: Segment::_id, order of vehicles in its lanes
+		NODE,      // id: Node::_id, order of vehicles in NodeVehicles::test
+	};
+	static constexpr const char* entity_type_str[] = { "vehicle of person", "segment", "node" };
+
+	struct Entity {
+		EntityType type;
+		int        id;
+		uint64_t   hash;
+	};
+
+	uint64_t total;
+	std::vector<Entity> entities;
+
+	// FNV-1a over values, independent of platform as long as float math is
+	struct Hasher {
+		uint64_t h = 0xcbf29ce484222325ull;
+
+		void add (uint64_t val) {
+			for (int i=0; i<8; ++i) {
+				h ^= (val >> (i*8)) & 0xff;
+				h *= 0x100000001b3ull;
+			}
+		}
+		void add (int val) { add((uint64_t)(uint32_t)val); }
+		void add (float val) {
+			uint32_t bits;
+			memcpy(&bits, &val, sizeof(bits));
+			add((uint64_t)bits);
+		}
+	};
+};
+
 class Network {
 public:
 	SERIALIZE(Network, settings, _stay_time);
@@ -583,28 +1205,62 @@ public:
 		mem.add("Network", sizeof(*this));
 		for (auto& i : nodes) i->mem_use(mem);
 		for (auto& i : segments) i->mem_use(mem);
+		graph.mem_use(mem);
+		path_cache.mem_use(mem);
+		pathfind_ctx.mem_use(mem);
+		pathfind_queue.mem_use(mem);
+		person_scheduler.mem_use(mem);
+		vehicle_states.mem_use(mem);
+		mem.add("Network::active_persons", MemUse::sizeof_alloc(active_persons));
+		ch.mem_use(mem);
 	}
 
 	std::vector<std::unique_ptr<Node>> nodes;
 	std::vector<std::unique_ptr<Segment>> segments;
 
+	// compiled graph all pathfinding runs on
+	TurnGraph graph;
+	bool _graph_dirty = false;
+	int  _graph_version = 0; // incremented on rebuild, to restart suspended queries
+
+	PathCache path_cache;
+
+	// declared after nodes and segments, so worker threads are stopped before those get destroyed
+	PathfindQueue pathfind_queue;
+
+	ContractionHierarchyBuilder ch;
+
+	SimVehicleStates vehicle_states;
+
+	// persons driving their vehicle on a trip, unordered, the simulation only iterates these
+	// added in PersonTrip::begin_trip and swap-removed once the trip is finished or canceled
+	std::vector<Person*> active_persons;
+	// persons in buildings get woken by this to start their next trip
+	PersonScheduler person_scheduler;
+	std::vector<int> _woken_persons;
+
+	SimThreads sim_threads;
+	// nodes grouped such that no two nodes in a group share a segment, so each group can be updated in parallel
+	// computed in update_cached()
+	std::vector<std::vector<Node*>> _node_colors;
+
 	Metrics metrics;
 	Settings settings;
 
 	DebugVehicles debug_vehicles;
 	
-	int _dijk_iter = 0;
-	int _dijk_iter_dupl = 0;
-	int _dijk_iter_lanes = 0;
+	// context for pathfinding on main thread, also used to visualize last query
+	PathfindContext pathfind_ctx;
 
-	int active_vehicles = 0;
+	// max speed_limit of all segments, for admissible A* heuristic
+	float _max_speed_limit = 0;
 
 	// Just an experiment for now
 	float _lane_switch_chance = 0.25f;
 	float _stay_time = 5*60;
 
 	void imgui () {
-		ImGui::Text("Active Vehicles: %5d", active_vehicles);
+		ImGui::Text("Active Vehicles: %5d", (int)active_persons.size());
 
 		metrics.imgui();
 		settings.imgui();
@@ -615,10 +1271,59 @@ public:
 		ImGui::DragFloat("stay_time", &_stay_time, 0);
 	}
 
-	int pathing_count;
+	int pathing_count; // pathfinding requests this frame
+
+	float _sim_accum = 0; // sim time not yet simulated, less than one tick
+	float _interp_t = 0; // [0,1) fraction of tick between last and next tick, to interpolate rendered positions
+	int   _last_substeps = 0;
+
+	// vehicles far from this run mesoscopic (Settings::MesoLOD), camera position of last frame
+	float3 lod_focus = 0;
+	// sim time advanced by ticks, for exit times of mesoscopic lane queues
+	double _sim_time = 0;
+
+	// wall time of each pass of the last tick in seconds, for profiling without tracy (see headless.cpp)
+	struct PassTimings {
+		float init = 0;
+		float segments = 0;
+		float nodes = 0;
+		float final_pass = 0;
+		float animation = 0;
+		float pathfinding = 0;
+	};
+	PassTimings _last_timings;
+
+	// Recompute network-wide cached values, call after nodes or segments were changed
+	void update_cached ();
+
+	int sim_thread_count () const {
+		return settings.sim_threads >= 0 ? settings.sim_threads :
+			max((int)std::thread::hardware_concurrency(), 1);
+	}
+
+	// call on changes that affect pathfinding costs only (like traffic lights), graph is rebuilt before next pathfinding batch
+	void invalidate_graph () {
+		_graph_dirty = true;
+	}
+	void rebuild_graph ();
+
+	// solve trip pathfinding on main thread with per-frame budget, contraction hierarchy queries are fast enough to never need slicing
+	bool pathfind_sliced () {
+		auto& pf = settings.pathfinding;
+		return (pf.frame_budget_iter > 0 || pf.frame_budget_us > 0) &&
+			!(pf.contraction_hierarchy && ch.get_current());
+	}
+
+	void add_active_person (Person& person);
+	void remove_active_person (Person& person);
+
+	// run fixed ticks for sim time passed this frame
+	void simulate (World& app, float frame_dt);
+	void tick (World& app, float dt);
+	void draw_debug (World& app, View3D& view);
 
-	void simulate (App& app);
-	void draw_debug (App& app, View3D& view);
+	// hash state after tick for determinism checks
+	void hash_state (StateHash& state);
 	
 	inline Segment* find_nearest_segment (float3 pos) const {
 		Segment* nearest_seg = nullptr;
@@ -424,7 +424,7 @@ struct Mesher {
 					float alpha0 = 1.0f / (float)conn_counts[lane_in];
 					float alpha1 = 1.0f / (float)conn_counts[lane_out];
 
-					push_lane_wear(node->calc_curve(lane_in, lane_out), alpha0, alpha1);
+					push_lane_wear(node->get_conn(lane_in, lane_out).bezier, alpha0, alpha1);
 				}
 			}
 		}
@@ -576,26 +576,29 @@ void ObjectRender::upload_vehicle_instances (Textures& texs, App& app, View3D& v
 	std::vector<DynamicVehicle> instances;
 	instances.reserve(4096); // not all persons have active vehicle, don't overallocate
 
+	float interp_t = app.network._interp_t;
+	auto frust = clac_view_frustrum(view);
+
 	for (auto& pers : app.entities.persons) {
 		if (pers->owned_vehicle)
-			push_vehicle_instance(instances, texs, *pers->owned_vehicle, view, app.input.real_dt);
+			push_vehicle_instance(instances, texs, *pers->owned_vehicle, view, frust, app.input.real_dt, interp_t);
 	}
 
 	for (auto& v : app.network.debug_vehicles.vehicles) {
-		push_vehicle_instance(instances, texs, *v, view, app.input.real_dt);
+		push_vehicle_instance(instances, texs, *v, view, frust, app.input.real_dt, interp_t);
 	}
 
 	if (app.network.debug_vehicles.preview_veh)
 		push_vehicle_instance(instances, texs, *app.network.debug_vehicles.preview_veh,
-							  view, app.input.real_dt);
+							  view, frust, app.input.real_dt, interp_t);
 
 	entities.vehicles.upload<0>(instances, true);
 }
 
 void ObjectRender::push_vehicle_instance (std::vector<DynamicVehicle>& instances,
-		Textures& texs, Vehicle& veh, View3D& view, float dt) {
+		Textures& texs, Vehicle& veh, View3D& view, View_Frustrum const& frust, float dt, float interp_t) {
 	if (veh.sim) {
-		push_vehicle_instance(instances, texs, veh, *veh.sim, view, dt);
+		push_vehicle_instance(instances, texs, veh, *veh.sim, view, frust, dt, interp_t);
 		
 		// make sure vehicles would never be drawn twice (if parking drawing was not in else if)
 		assert(veh.parking == nullptr || !veh.parking->occupied_by(&veh));
@@ -630,7 +633,7 @@ void ObjectRender::push_parked_vehicle_instance (std::vector<DynamicVehicle>& in
 }
 
 void ObjectRender::push_vehicle_instance (std::vector<DynamicVehicle>& instances,
-		Textures& texs, Vehicle& veh, network::SimVehicle& sim, View3D& view, float dt) {
+		Textures& texs, Vehicle& veh, network::SimVehicle& sim, View3D& view, View_Frustrum const& frust, float dt, float interp_t) {
 	uint32_t instance_id = (uint32_t)instances.size();
 	auto& instance = instances.emplace_back();
 
@@ -643,7 +646,7 @@ void ObjectRender::push_vehicle_instance (std::vector<DynamicVehicle>& instances
 
 	bool blinker_on = sim.update_blinker(rand1, dt);
 
-	auto pos = sim._calc_pos();
+	auto pos = sim.calc_render_pos(interp_t);
 
 	instance.mesh_id = entities.vehicle_meshes.asset2mesh_id[veh.asset];
 	instance.instance_id = instance_id;
@@ -658,9 +661,13 @@ void ObjectRender::push_vehicle_instance (std::vector<DynamicVehicle>& instances
 		
 	float3x3 heading_rot = rotate3_Z(pos.ang);
 
-	// skip expensive bone matricies computation when too far away
-	float anim_LOD_dist = 250;
-	if (length_sqr(pos.pos - view.cam_pos) > anim_LOD_dist*anim_LOD_dist) {
+	// sim only animates visible vehicles, decide for next ticks
+	float r = veh.asset->length()*0.5f + anim_margin;
+	sim.vis.visible = length_sqr(pos.pos - view.cam_pos) <= anim_dist*anim_dist &&
+		!frustrum_cull_aabb(frust, AABB3(pos.pos - r, pos.pos + r));
+
+	// skip expensive bone matricies computation when not animated
+	if (!sim.vis.valid) {
 		for (auto& mat : instance.bone_rot) {
 			mat = float4x4(heading_rot);
 		}
@@ -680,7 +687,7 @@ void ObjectRender::push_vehicle_instance (std::vector<DynamicVehicle>& instances
 			(bone_mats[boneID].bone2mesh * float4x4(bone_rot) * bone_mats[boneID].mesh2bone);
 	};
 
-	float wheel_ang = sim.wheel_roll * -deg(360);
+	float wheel_ang = sim.vis.wheel_roll * -deg(360);
 	float3x3 roll_mat = rotate3_Z(wheel_ang);
 
 	float rear_axle_x = (bone_mats[VBONE_WHEEL_BL].bone2mesh * float4(0,0,0,1)).x;
@@ -691,13 +698,13 @@ void ObjectRender::push_vehicle_instance (std::vector<DynamicVehicle>& instances
 		float2 wheel_pos2d = (float2)(bone_mats[boneID].bone2mesh * float4(0,0,0,1));
 		float2 wheel_rel2d = wheel_pos2d - float2(rear_axle_x, 0);
 
-		float c = sim.turn_curv;
+		float c = sim.vis.turn_curv;
 		float ang = -atanf((c * wheel_rel2d.x) / (c * -wheel_rel2d.y - 1.0f));
 
 		return rotate3_Y(ang);
 	};
 
-	float3x3 base_rot = rotate3_X(sim.suspension_ang.x) * rotate3_Z(-sim.suspension_ang.y);
+	float3x3 base_rot = rotate3_X(sim.vis.suspension_ang.x) * rotate3_Z(-sim.vis.suspension_ang.y);
 	set_bone_rot(VBONE_BASE, base_rot);
 
 
@@ -588,15 +588,19 @@ struct ObjectRender {
 	void upload_static_instances (Textures& texs, App& app);
 	void update_dynamic_traffic_signals (Textures& texs, Network& net);
 
+	// vehicles are animated (SimVehicle::Visuals) only within this distance and inside the view frustum expanded by anim_margin
+	float anim_dist = 250;
+	float anim_margin = 10;
+
 	void upload_vehicle_instances (Textures& texs, App& app, View3D& view);
 
 	void push_vehicle_instance (std::vector<DynamicVehicle>& instances,
-		Textures& texs, Vehicle& veh, View3D& view, float dt);
+		Textures& texs, Vehicle& veh, View3D& view, View_Frustrum const& frust, float dt, float interp_t);
 	
 	void push_parked_vehicle_instance (std::vector<DynamicVehicle>& instances,
 		Textures& texs, Vehicle& veh);
 	void push_vehicle_instance (std::vector<DynamicVehicle>& instances,
-		Textures& texs, Vehicle& veh, network::SimVehicle& sim, View3D& view, float dt);
+		Textures& texs, Vehicle& veh, network::SimVehicle& sim, View3D& view, View_Frustrum const& frust, float dt, float interp_t);
 };
 
 } // namespace ogl
@@ -0,0 +1,83 @@
+#include "common.hpp"
+#include "turn_graph.hpp"
+#include "network_sim.hpp"
+
+namespace network {
+
+void TurnGraph::build (Network& net, float avoid_traffic_lights) {
+	ZoneScoped;
+
+	int num_vertices = (int)net.segments.size() * 2;
+
+	edges_begin.resize(num_vertices + 1);
+	edges.clear();
+	edges.reserve(num_vertices * 3);
+	vertex_pos.resize(num_vertices);
+
+	this->avoid_traffic_lights = avoid_traffic_lights;
+
+	for (int v=0; v<num_vertices; ++v) {
+		edges_begin[v] = (int)edges.size();
+
+		Segment* seg = net.segments[vertex_seg(v)].get();
+		assert(seg->_id == vertex_seg(v));
+		LaneDir dir = vertex_dir(v);
+		Node* node = seg->get_node_in_dir(dir);
+
+		vertex_pos[v] = node->pos;
+
+		// turns allowed by any lane of segment entering node
+		Turns allowed = Turns::NONE;
+		for (auto lane : seg->lanes_in_dir(dir)) {
+			allowed |= lane.get().allowed_turns;
+		}
+
+		float light_cost = node->traffic_light ? node->traffic_light->approx_wait_time() * avoid_traffic_lights : 0;
+
+		for (auto* out_seg : node->segments) {
+			if (out_seg->out_lanes(node).count() == 0)
+				continue; // one-way segment can't be entered from this node
+			if (!is_turn_allowed(node, seg, out_seg, allowed))
+				continue;
+
+			float cost = light_cost + segment_cost(out_seg);
+			assert(cost > 0);
+			edges.push_back({ vertex(out_seg, out_seg->get_dir_from_node(node)), cost });
+		}
+	}
+	edges_begin[num_vertices] = (int)edges.size();
+}
+
+float TurnGraph::path_cost (float start_cost, std::vector<Segment*> const& path) const {
+	if (path.size() < 2) return INF;
+
+	// start direction is ambiguous for uturns on start segment, so just try both
+	float min_cost = INF;
+	for (LaneDir start_dir : { LaneDir::FORWARD, LaneDir::BACKWARD }) {
+		int v = vertex(path[0], start_dir);
+		float cost = start_cost;
+
+		for (int i=1; i<(int)path.size() && cost < INF; ++i) {
+			Node* node = path[i-1]->get_node_in_dir(vertex_dir(v));
+			if (path[i]->node_a != node && path[i]->node_b != node) {
+				cost = INF; // path does not continue at node this direction leads to
+				break;
+			}
+
+			int next = vertex(path[i], path[i]->get_dir_from_node(node));
+
+			float edge_cost = INF;
+			for (int e=edges_begin[v]; e<edges_begin[v+1]; ++e) {
+				if (edges[e].target == next)
+					edge_cost = min(edge_cost, edges[e].cost);
+			}
+			cost += edge_cost;
+			v = next;
+		}
+
+		min_cost = min(min_cost, cost);
+	}
+	return min_cost;
+}
+
+} // namespace network
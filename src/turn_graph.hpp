@@ -0,0 +1,52 @@
+#pragma once
+#include "common.hpp"
+#include "network.hpp"
+
+namespace network {
+
+// Network compiled into an edge-based graph for pathfinding, needed to respect turn restrictions,
+//  since the turns allowed at a node depend on the segment the node was entered from
+// vertices: directed segments, ie. a segment driven in one direction (towards node_b or node_a)
+// edges: turns allowed at the node the segment leads to, cost is traffic light penalty + cost of the next segment
+// Turn legality and costs are precomputed, so pathfinding only touches these flat arrays
+// Needs to be rebuilt when the network, traffic lights or cost settings change
+struct TurnGraph {
+	struct Edge {
+		int   target;
+		float cost;
+	};
+
+	// CSR, edges of vertex v are edges[edges_begin[v]] to edges[edges_begin[v+1]-1]
+	std::vector<int>  edges_begin;
+	std::vector<Edge> edges;
+
+	// position of the node each vertex leads to, for A* heuristic
+	std::vector<float3> vertex_pos;
+
+	float avoid_traffic_lights = -1; // setting this was built with
+
+	int num_vertices () const { return (int)edges_begin.size() - 1; }
+
+	static int vertex (Segment* seg, LaneDir dir) {
+		assert(seg->_id >= 0);
+		return seg->_id*2 + (dir == LaneDir::FORWARD ? 0 : 1);
+	}
+	static int vertex_seg (int v) { return v / 2; }
+	static LaneDir vertex_dir (int v) { return (v & 1) == 0 ? LaneDir::FORWARD : LaneDir::BACKWARD; }
+
+	static float segment_cost (Segment* seg) {
+		float len = seg->_length + seg->node_a->_radius + seg->node_b->_radius;
+		return len / seg->asset->speed_limit;
+	}
+
+	void build (Network& net, float avoid_traffic_lights);
+
+	// Evaluate cost of a segment sequence the same way the graph does, INF if it contains a disallowed turn
+	float path_cost (float start_cost, std::vector<Segment*> const& path) const;
+
+	void mem_use (MemUse& mem) {
+		mem.add("TurnGraph", MemUse::sizeof_alloc(edges_begin) + MemUse::sizeof_alloc(edges) + MemUse::sizeof_alloc(vertex_pos));
+	}
+};
+
+} // namespace network
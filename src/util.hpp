@@ -1,6 +1,7 @@
 #pragma once
 #include "common.hpp"
 #include "bezier.hpp"
+#include <bit>
 
 // TODO: Is there a resonable way of allowing whole numbers (30, 45, 70 etc.) of speed in both unit systems to match when switching?
 inline constexpr float KPH_PER_MS = 3.6f;
@@ -99,8 +100,7 @@ public:
 		var = ref;
 	}
 
-	template<>
-	NullableVariant (nullptr_t) {
+	NullableVariant (std::nullptr_t) {
 		var = null_t();
 	}
 
@@ -301,21 +301,22 @@ struct MinHeapFunc {
 		return (idx - 1) / 2;
 	}
 
-	static void verify_heap (T* items, int count) {
-		for (int i=0; i<(int)items.size(); ++i) {
+	void verify_heap () {
+		int count = (int)items.size();
+		for (int i=0; i<count; ++i) {
 			int first_child = first_child_index(i);
 
 			// equality breaks parent < child assert, check !child < parent instead
-			for (int i=0; i<2; ++i) {
-				if (first_child + i < count) {
-					assert(!( get_key(items[first_child + i]) > get_key(items[i]) ));
+			for (int j=0; j<2; ++j) {
+				if (first_child + j < count) {
+					assert(!( get_key(items[first_child + j]) < get_key(items[i]) ));
 				}
 			}
 
 			assert(get_idx(items[i]) == i);
 		}
 	}
-	static void verify_heap2 (T* items, int count) {
+	void verify_heap2 () {
 		for (int i=0; i<(int)items.size(); ++i) {
 			assert(get_idx(items[i]) == i);
 		}
@@ -328,8 +329,8 @@ struct MinHeapFunc {
 		items[a] = val_b;
 		items[b] = val_a;
 
-		get_idx(val_a) = a;
-		get_idx(val_b) = b;
+		get_idx(val_a) = b;
+		get_idx(val_b) = a;
 	}
 
 	void bubble_up (T* items, int count, int idx) {
@@ -455,6 +456,84 @@ struct MinHeapFunc {
 	}
 };
 
+// Monotone priority queue with integer keys (radix heap), popped keys never decrease and pushed keys must be >= last popped key
+// Items are in bucket 0 if their key equals the last popped key, else in the bucket of the highest bit their key differs in
+// Amortized O(log range) per item, but only does cheap integer ops and no compares between items
+// Supports erase via cached index (position in bucket), which allows decrease-key as erase + push
+template <typename T, typename GET_KEY, typename GET_IDX>
+struct RadixHeapFunc {
+	static constexpr int NUM_BUCKETS = 33;
+
+	std::vector<T> (&buckets)[NUM_BUCKETS];
+	uint32_t& last; // last popped key
+
+	GET_KEY get_key; // uint32_t (T const&)
+	GET_IDX get_idx; // int& (T&), index in bucket, -1 if not in heap
+
+	int bucket_index (uint32_t key) const {
+		assert(key >= last);
+		return key == last ? 0 : 32 - std::countl_zero(key ^ last);
+	}
+
+	bool empty () const {
+		for (auto& b : buckets) {
+			if (!b.empty()) return false;
+		}
+		return true;
+	}
+
+	_FORCEINLINE void push (T item) {
+		auto& bucket = buckets[bucket_index(get_key(item))];
+		get_idx(item) = (int)bucket.size();
+		bucket.push_back(std::move(item));
+	}
+	// item must still have the key it was pushed with
+	_FORCEINLINE void erase (T item) {
+		auto& bucket = buckets[bucket_index(get_key(item))];
+		int idx = get_idx(item);
+		assert(idx >= 0 && idx < (int)bucket.size());
+
+		// swap in last item
+		if (idx != (int)bucket.size()-1) {
+			bucket[idx] = std::move(bucket.back());
+			get_idx(bucket[idx]) = idx;
+		}
+		bucket.pop_back();
+		get_idx(item) = -1;
+	}
+
+	T pop () {
+		if (buckets[0].empty()) {
+			// refill bucket 0 from first non-empty bucket
+			int i = 1;
+			while (buckets[i].empty()) {
+				i++;
+				assert(i < NUM_BUCKETS); // pop on empty heap
+			}
+
+			uint32_t min_key = UINT32_MAX;
+			for (auto& item : buckets[i])
+				min_key = min(min_key, get_key(item));
+			last = min_key;
+
+			// all items go to lower buckets relative to new last key
+			auto items = std::move(buckets[i]);
+			buckets[i].clear();
+			for (auto& item : items)
+				push(std::move(item));
+
+			// keep allocation around
+			buckets[i] = std::move(items);
+			buckets[i].clear();
+		}
+
+		T res = std::move(buckets[0].back());
+		buckets[0].pop_back();
+		get_idx(res) = -1;
+		return res;
+	}
+};
+
 struct CurvedDecalVertex {
 	float3 pos0, pos1;
 	float3 right0, right1; // right vector for decal boxes
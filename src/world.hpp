@@ -0,0 +1,312 @@
+#pragma once
+#include "common.hpp"
+#include "assets.hpp"
+#include "game_time.hpp"
+#include "terrain.hpp"
+#include "network.hpp"
+#include "network_sim.hpp"
+#include "entities.hpp"
+#include "interact.hpp"
+
+// json file load/save, errors are logged instead of thrown
+struct SavefileIO {
+	static constexpr const char* app_settings_json = "settings.json";
+
+	template <typename FUNC>
+	static inline void load (const char* filepath, FUNC from_json) {
+		ZoneScoped;
+		try {
+			json json;
+			if (load_json(filepath, &json)) {
+				from_json(json);
+			}
+		} catch (std::exception& ex) {
+			log_error("Error when deserializing something: %s", ex.what());
+		}
+	}
+	template <typename FUNC>
+	static inline void save (const char* filepath, FUNC to_json) {
+		ZoneScoped;
+		try {
+			json json;
+			to_json(json);
+			save_json(filepath, json);
+		} catch (std::exception& ex) {
+			log_error("Error when serializing something: %s", ex.what());
+		}
+	}
+};
+
+struct TestMapBuilder {
+	SERIALIZE(TestMapBuilder, _grid_n, _persons_n, _seed, _intersection_radius, _connection_chance)
+	
+	int _grid_n = 10;
+	int _persons_n = 600;
+	int _seed = 0; // for road connections and persons, so benchmarks can use different but reproducible maps
+
+	float _intersection_radius = 0.0f;
+
+	float _connection_chance = 0.7f;
+
+	void update (Assets& assets, Entities& entities, Network& net, Interaction& interact, Random& sim_rand) {
+		using namespace network;
+
+		bool buildings = ImGui::SliderInt("grid_n", &_grid_n, 1, 100)
+			|| assets.assets_reloaded;
+		buildings = ImGui::InputInt("seed", &_seed) || buildings;
+		buildings = ImGui::Button("Respawn buildings") || buildings;
+
+		bool persons  = ImGui::SliderInt("persons_n",  &_persons_n,  0, 1000)
+			|| assets.assets_reloaded || buildings;
+		persons = ImGui::Button("Respawn Residents") || persons;
+
+		ImGui::SliderFloat("intersection_radius", &_intersection_radius, 0, 30);
+
+		ImGui::SliderFloat("connection_chance", &_connection_chance, 0, 1);
+		
+		//static DistributionPlotter aggress_dist;
+		//aggress_dist.plot_distribution("vehicle topspeed_accel_mul",
+		//	(int)entities.persons.size(), [&] (int i) { return entities.persons[i]->topspeed_accel_mul(); },
+		//	0.5f, 1.6f, false);
+		
+		spawn(assets, entities, net, interact, sim_rand, buildings, persons);
+	}
+
+	void spawn (Assets& assets, Entities& entities, Network& net, Interaction& interact, Random& sim_rand,
+			bool buildings, bool persons) {
+		using namespace network;
+
+		if (persons) {
+			interact.clear_sel<Vehicle*>();
+
+			// in-flight pathfinding references persons, buildings and network
+			net.pathfind_queue.clear();
+			net.person_scheduler.clear();
+			net.active_persons.clear();
+			net.vehicle_states.clear(); // SimVehicles get destroyed with persons
+
+			entities.persons.clear();
+			entities.persons.resize(_persons_n);
+		}
+
+		if (buildings) {
+			ZoneScopedN("spawn buildings");
+
+			interact.clear_sel<Node*>();
+			interact.clear_sel<Segment*>();
+			interact.clear_sel<Building*>();
+
+			entities.buildings.clear();
+			net = {};
+
+			Random rand(_seed);
+
+			auto base_pos = float3(100,100,0);
+			auto* house0 = assets.buildings["house"].get();
+			auto* house1 = assets.buildings["urban_mixed_use"].get();
+
+			net.nodes.resize((_grid_n+1)*(_grid_n+1));
+			
+			auto get_node = [&] (int x, int y) -> Node* {
+				return net.nodes[y * (_grid_n+1) + x].get();
+			};
+			
+			auto* small_road  = assets.networks["small road"].get();
+			auto* medium_road = assets.networks["medium road"].get();
+			auto* medium_road_asym = assets.networks["medium road asym"].get();
+			
+			float2 spacing = float2(60, 60);
+
+			auto road_type = [&] (int2 pos, int axis, bool* flip=nullptr) {
+				bool type1 = wrap(pos[axis^1]-5, 0,10) == 0;
+
+				bool type2_0 = wrap(pos[axis]-5, 0,10) <= 1;
+				bool type2_1 = wrap(pos[axis]-5, 0,10) >= 8;
+
+				//bool at_edge = pos.x <= (axis ? 4 : 4) || pos.y <= (axis ? 4 : 4) ||
+				//	pos.x >= _grid_n-(axis ? 4 : 4) || pos.y >= _grid_n-(axis ? 4 : 4);
+				bool at_edge = false;
+
+				if (type1 && !at_edge) {
+					if (type2_0 || type2_1) {
+						if (flip) *flip = type2_0;
+						return medium_road_asym;
+					}
+					return medium_road;
+				}
+				return small_road;
+			};
+
+			// create path nodes grid
+			for (int y=0; y<_grid_n+1; ++y)
+			for (int x=0; x<_grid_n+1; ++x) {
+				auto node = std::make_unique<Node>();
+				node->pos = base_pos + float3((float)x,(float)y,0) * float3(spacing, 0);
+
+				bool big_intersec = wrap(x-5, 0,10) == 0 && wrap(y-5, 0,10) == 0;
+				node->_fully_dedicated_turns = big_intersec;
+
+				net.nodes[y * (_grid_n+1) + x] = std::move(node);
+			}
+			
+			auto create_segment = [&] (NetworkAsset* layout, Node* node_a, Node* node_b, bool flip) {
+				assert(node_a && node_b && node_a != node_b);
+
+				if (flip) std::swap(node_a, node_b);
+
+				float3 dir = normalizesafe(node_b->pos - node_a->pos);
+
+				auto* seg = net.segments.emplace_back(std::make_unique<Segment>()).get();
+				seg->asset = layout;
+				seg->node_a = node_a;
+				seg->node_b = node_b;
+
+				node_a->segments.push_back(seg);
+				node_b->segments.push_back(seg);
+				
+				seg->pos_a = node_a->pos;
+				seg->pos_b = node_b->pos;
+
+				seg->vehicles.lanes.resize(layout->lanes.size());
+
+				seg->update_cached();
+			};
+
+			// create x paths
+			for (int y=0; y<_grid_n+1; ++y)
+			for (int x=0; x<_grid_n; ++x) {
+				bool flip;
+				auto layout = road_type(int2(x,y), 0, &flip);
+
+				auto* a = get_node(x, y);
+				auto* b = get_node(x+1, y);
+				create_segment(layout, a, b, flip);
+			}
+			// create y paths
+			for (int y=0; y<_grid_n; ++y)
+			for (int x=0; x<_grid_n+1; ++x) {
+				bool flip;
+				auto layout = road_type(int2(x,y), 1, &flip);
+
+				if (layout != small_road || rand.chance(_connection_chance)) {
+					auto* a = get_node(x, y);
+					auto* b = get_node(x, y+1);
+					create_segment(layout, a, b, flip);
+				}
+			}
+
+			for (auto& node : net.nodes) {
+				node->update_cached(_intersection_radius); // TODO: currently needs seg->update_cached(); to configure lanes!
+				node->set_defaults();
+			}
+			for (auto& seg : net.segments) {
+				seg->update_cached(); // need to re-run to update lengths, TODO: fix this, maybe by computing things on demand via a flagging system?
+			}
+			net.update_cached();
+
+			for (int y=0; y<_grid_n+1; ++y)
+			for (int x=0; x<_grid_n; ++x) {
+				Random rand(hash(int2(x,y))); // position-based rand
+
+				Segment* conn_seg = nullptr;
+				{
+					auto* a = get_node(x, y);
+					auto* b = get_node(x+1, y);
+					for (auto& seg : a->segments) {
+						auto* other_node = seg->node_a != a ? seg->node_a : seg->node_b;
+						if (other_node == b) {
+							// found path in front of building
+							conn_seg = seg;
+							break;
+						}
+					}
+				}
+
+				float3 road_center = (float3((float)x,(float)y,0) + float3(0.5f,0,0)) * float3(spacing,0);
+				float roadL = conn_seg->asset->edgeL;
+				float roadR = conn_seg->asset->edgeR;
+				
+				{
+					auto* asset = rand.uniformi(0, 2) ? house0 : house1;
+					float3 pos1 = base_pos + road_center + float3(0,  roadR + asset->size.y, 0);
+					float rot1 = deg(90);
+					auto build1 = std::make_unique<Building>(Building{ asset, pos1, rot1, conn_seg });
+					build1->update_cached(asset == house0 ? 2 : 0);
+					entities.buildings.emplace_back(std::move(build1));
+				}
+				{
+					auto* asset = rand.uniformi(0, 2) ? house0 : house1;
+					float3 pos2 = base_pos + road_center - float3(0, -roadL + asset->size.y, 0);
+					float rot2 = deg(-90);
+					auto build2 = std::make_unique<Building>(Building{ asset, pos2, rot2, conn_seg });
+					build2->update_cached(asset == house0 ? 2 : 0);
+					entities.buildings.emplace_back(std::move(build2));
+				}
+			}
+
+			entities.buildings_changed = true;
+		}
+		
+		if (persons) {
+			ZoneScopedN("spawn persons");
+
+			interact.clear_sel<Vehicle*>();
+
+			// remove references
+			for (auto& node : net.nodes) {
+				//node->vehicles.free.list.clear();
+				node->vehicles.test.list.clear();
+			}
+			for (auto& seg : net.segments) {
+				for (auto& lane : seg->vehicles.lanes) {
+					lane.clear();
+				}
+			}
+
+			entities.persons.clear();
+			entities.persons.resize(_persons_n);
+			
+			sim_rand = Random(_seed);
+
+			if (entities.buildings.size() > 0) {
+				for (int i=0; i<_persons_n; ++i) {
+					auto* building = entities.buildings[sim_rand.uniformi(0, (int)entities.buildings.size())].get();
+					
+					auto& person = entities.persons[i];
+					person = std::make_unique<Person>(assets, sim_rand, building);
+					person->_id = i;
+					net.person_scheduler.schedule(*person, person->stay_timer);
+				}
+			}
+		}
+	}
+};
+
+// Everything the simulation touches, without window, renderer or camera, so it can also run headless (see headless.cpp)
+class World {
+public:
+
+	World (Input& input): interact{input, _view, assets, heightmap, network, entities} {}
+
+	Options options;
+	
+	Assets assets;
+
+	GameTime time;
+
+	OverlayDraw overlay;
+
+	View3D _view;
+
+	Heightmap heightmap;
+	Network network;
+	Entities entities; // Entities after network, because entities refer to network and else dtors break! This needs to be fixed!
+	
+	// view dependency is unfortunate
+	Interaction interact;
+
+	TestMapBuilder test_map_builder;
+
+	// rand set by TestMapBuilder to get consistent paths for testing
+	Random sim_rand;
+};